@@ -7,20 +7,48 @@
 #include <sstream>
 #include <cstdint>
 #include <functional>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
+#include <optional>
+#include <filesystem>
 
 #include <bvh/bvh.hpp>
 #include <bvh/binned_sah_builder.hpp>
+#include <bvh/bin_schedule.hpp>
+#include <bvh/work_stealing_executor.hpp>
 #include <bvh/sweep_sah_builder.hpp>
 #include <bvh/spatial_split_bvh_builder.hpp>
 #include <bvh/locally_ordered_clustering_builder.hpp>
+#include <bvh/approximate_agglomerative_clustering_builder.hpp>
+#include <bvh/radix_tree_bvh_builder.hpp>
 #include <bvh/linear_bvh_builder.hpp>
+#include <bvh/hierarchical_linear_bvh_builder.hpp>
 #include <bvh/parallel_reinsertion_optimizer.hpp>
+#include <bvh/treelet_restructuring_optimizer.hpp>
 #include <bvh/node_layout_optimizer.hpp>
 #include <bvh/leaf_collapser.hpp>
 #include <bvh/heuristic_primitive_splitter.hpp>
 #include <bvh/hierarchy_refitter.hpp>
+#include <bvh/rotating_hierarchy_refitter.hpp>
+#include <bvh/dynamic_bvh_updater.hpp>
 #include <bvh/single_ray_traverser.hpp>
+#include <bvh/packet_traverser.hpp>
+#include <bvh/wide_bvh.hpp>
+#include <bvh/wide_bvh_collapser.hpp>
+#include <bvh/wide_bvh_traverser.hpp>
+#include <bvh/compressed_bvh.hpp>
+#include <bvh/compressed_bvh_converter.hpp>
+#include <bvh/compressed_bvh_traverser.hpp>
+#include <bvh/triangle_block.hpp>
+#include <bvh/stackless_traverser.hpp>
+#include <bvh/octant_traverser.hpp>
+#include <bvh/ray_queries.hpp>
 #include <bvh/primitive_intersectors.hpp>
+#include <bvh/instance_intersectors.hpp>
+#include <bvh/transformed_traverser.hpp>
+#include <bvh/affine_transform.hpp>
 #include <bvh/triangle.hpp>
 
 using Scalar      = float;
@@ -29,14 +57,30 @@ using Triangle    = bvh::Triangle<Scalar>;
 using BoundingBox = bvh::BoundingBox<Scalar>;
 using Ray         = bvh::Ray<Scalar>;
 using Bvh         = bvh::Bvh<Scalar>;
+using WideBvh4    = bvh::WideBvh<Scalar, 4>;
+using WideBvh8    = bvh::WideBvh<Scalar, 8>;
+using CompressedBvh = bvh::CompressedBvh<Scalar>;
+using TriangleBlocks4 = bvh::TriangleBlocks<Triangle, 4>;
+using TriangleBlocks8 = bvh::TriangleBlocks<Triangle, 8>;
+using Instance        = bvh::Instance<Bvh, Triangle>;
+using AffineTransform = bvh::AffineTransform<Scalar>;
 
 #include "obj.hpp"
+#include "binary_mesh.hpp"
+#include "bvh_cache.hpp"
 #include "camera.h"
+#ifndef BVH_HEADLESS_BENCH
 #include "setting.h"
+#endif
 #include "profiler.h"
+#include "tile_scheduler.h"
 
+// Size of the square tiles in which the image is split for rendering
+static constexpr size_t default_tile_size = 16;
+
+// Returns the fastest run, in milliseconds
 template <typename F>
-void profile(const char* task, F f, size_t runs = 1)
+double profile(const char* task, F f, size_t runs = 1)
 {
     using namespace std::chrono;
     std::vector<double> timings;
@@ -46,7 +90,7 @@ void profile(const char* task, F f, size_t runs = 1)
         auto start_tick = high_resolution_clock::now();
         f();
         auto end_tick = high_resolution_clock::now();
-        timings.push_back(duration_cast<milliseconds>(end_tick - start_tick).count());
+        timings.push_back(duration<double, std::milli>(end_tick - start_tick).count());
     }
 
     std::sort(timings.begin(), timings.end());
@@ -63,6 +107,7 @@ void profile(const char* task, F f, size_t runs = 1)
             << timings[timings.size() / 2] << "/"
             << timings.back() << "ms (min/med/max of " << runs << " runs)" << std::endl;
     }
+    return timings.front();
 }
 
 static size_t compute_bvh_depth(const Bvh& bvh, size_t node_index = 0)
@@ -78,6 +123,66 @@ static size_t compute_bvh_depth(const Bvh& bvh, size_t node_index = 0)
         return 0;
 }
 
+static Scalar compute_sah_cost(const Bvh& bvh)
+{
+    // The SAH cost is only exposed to derived classes
+    struct SahCost : bvh::SahBasedAlgorithm<Bvh>
+    {
+        using bvh::SahBasedAlgorithm<Bvh>::compute_cost;
+    };
+    return SahCost().compute_cost(bvh);
+}
+
+// Largest number of bins supported by the binned builders (see `with_max_bin_count()`)
+static constexpr size_t max_bin_count = 64;
+
+// Calls `f` with the smallest bin count, among the ones for which the binned builders
+// are instantiated, that is greater than or equal to the given bin count.
+template <typename F>
+static auto with_max_bin_count(size_t bin_count, F&& f)
+{
+    if (bin_count <= 8)  return f(std::integral_constant<size_t, 8>());
+    if (bin_count <= 16) return f(std::integral_constant<size_t, 16>());
+    if (bin_count <= 32) return f(std::integral_constant<size_t, 32>());
+    return f(std::integral_constant<size_t, max_bin_count>());
+}
+
+// Calls `f` with a value of the unsigned integer type used to store Morton codes of the given width.
+template <typename F>
+static auto with_morton_type(size_t morton_bits, F&& f)
+{
+    if (morton_bits == 64) return f(uint64_t());
+    return f(uint32_t());
+}
+
+// Parses a bin schedule of the form "<depth>:<bins>,<depth>:<bins>,...".
+static bool parse_bin_schedule(const char* str, bvh::BinSchedule& schedule)
+{
+    while (*str) {
+        char* end;
+        size_t depth = strtoull(str, &end, 10);
+        if (end == str || *end != ':')
+            return false;
+        str = end + 1;
+        size_t bin_count = strtoull(str, &end, 10);
+        if (end == str || bin_count < 2 || bin_count > max_bin_count || (*end && *end != ','))
+            return false;
+        schedule.set(depth, bin_count);
+        str = *end ? end + 1 : end;
+    }
+    return !schedule.empty();
+}
+
+template <typename Builder>
+static typename Builder::Binning find_binning(const char* name)
+{
+    if (!strcmp(name, "center"))
+        return Builder::Binning::CenterBounds;
+    if (!strcmp(name, "simd"))
+        return Builder::Binning::SimdCenterBounds;
+    return Builder::Binning::NodeBounds;
+}
+
 static int not_enough_arguments(const char* option)
 {
     std::cerr << "Not enough arguments for '" << option << "'" << std::endl;
@@ -88,26 +193,59 @@ static void usage()
 {
     std::cout <<
         "Usage: benchmark [options] file.obj\n"
+        "\nThe scene can also be a binary mesh converted with 'obj2bin', which is mapped into memory.\n"
         "\nOptions:\n"
         "  --help                  Shows this message.\n"
         "  --builder <name>        Sets the BVH builder to use (defaults to 'binned_sah').\n"
+        "  --binning <mode>        Sets the binning mode of 'binned_sah': 'node', 'center', or 'simd' (defaults to 'node').\n"
+        "  --bins <n>              Sets the number of bins of 'binned_sah' and 'spatial_split' (defaults to 16 and 64, at most 64).\n"
+        "  --bin-schedule <d>:<n>,...\n"
+        "                          Uses n bins for the nodes at depth d and deeper, until the next entry\n"
+        "                          (e.g. '0:64,4:32,10:8'). Depths before the first entry use '--bins'.\n"
+        "  --morton-bits <n>       Sets the width of the Morton codes of the Morton-based builders to 32 or 64 bits\n"
+        "                          (defaults to 32, which gives 10 bits per axis instead of 21).\n"
+        "  --work-stealing <n>     Builds 'binned_sah', 'sweep_sah', and 'spatial_split' BVHs with a work-stealing\n"
+        "                          executor of n threads instead of OpenMP (0 uses all hardware threads). The top levels\n"
+        "                          are built one node at a time with all threads, and the subtrees below them in parallel.\n"
         "  --permute               Activates the primitive permutation optimization (disabled by default).\n"
         "  --optimize-layout       Activates the node layout optimization (disabled by default).\n"
         "  --collapse-leaves       Activates the leaf collapse optimization (disabled by default).\n"
         "  --parallel-reinsertion  Activates the parallel reinsertion optimization (disabled by default).\n"
+        "  --treelet-restructuring Activates the treelet restructuring optimization (disabled by default).\n"
         "  --pre-split <percent>   Activates pre-splitting and sets the percentage of references (disabled by default).\n"
         "  --build-iterations <n>  Sets the number of construction iterations (equal to 1 by default).\n"
+        "  --traverser <name>      Sets the traversal algorithm to use (defaults to 'single').\n"
+        "  --triangle-blocks <n>   Intersects leaves with SIMD blocks of 4 or 8 triangles (disabled by default).\n"
+        "  --dynamic-updates <n>   Removes n random triangles from the BVH after construction, and inserts them back\n"
+        "                          (disabled by default, incompatible with '--permute' and '--pre-split').\n"
+        "  --animate <n> <deg>     Twists the scene by deg more degrees every frame, for n frames, and compares refitting,\n"
+        "                          refitting with rotations, and rebuilding the BVH (disabled by default).\n"
+        "  --bvh-cache <dir>       Loads the BVH and the triangles from a memory-mapped cache file in the given directory,\n"
+        "                          and writes that file after building the BVH if it does not exist (disabled by default,\n"
+        "                          incompatible with '--dynamic-updates' and '--animate').\n"
+        "  --instances <n>         Renders n copies of the scene, placed on a grid with random rotations, with a two-level\n"
+        "                          BVH where the copies share the BVH of the scene (disabled by default, only for\n"
+        "                          rendering images with the 'single' traverser and without triangle blocks).\n"
+        "  --random-rays <n>       Traces n random rays instead of rendering an image (disabled by default).\n"
+        "  --ao-rays <n>           Traces n ambient occlusion rays per pixel, with and without ray sorting,\n"
+        "                          instead of rendering an image (disabled by default).\n"
         "  --eye <x> <y> <z>       Sets the position of the camera.\n"
         "  --dir <x> <y> <z>       Sets the direction of the camera.\n"
         "  --up  <x> <y> <z>       Sets the up vector of the camera.\n"
         "  --fov <degrees>         Sets the field of view.\n"
         "  --width <pixels>        Sets the image width.\n"
         "  --height <pixels>       Sets the image height.\n"
+        "  --tile-size <pixels>    Sets the size of the tiles distributed to the threads (defaults to 16).\n"
         "  -o <file.ppm>           Sets the output file name (defaults to 'render.ppm').\n\n"
         "  --rotate <axis> <degrees>\n\n"
         "    Rotates the scene by the given amount of degrees on the\n"
-        "    given axis (valid axes are 'x', 'y', or 'z'). This is mainly\n"
-        "    intended to test the impact of pre-splitting.\n\n"
+        "    given axis (valid axes are 'x', 'y', or 'z'). The BVH is\n"
+        "    built once, and rays are transformed into its space, which\n"
+        "    requires the 'single' traverser.\n\n"
+        "  --rotate-triangles <axis> <degrees>\n\n"
+        "    Same as '--rotate', but rotates the triangles before building\n"
+        "    the BVH. This is mainly intended to test the impact of\n"
+        "    pre-splitting.\n\n"
         "  --collect-statistics <t> <i> <c>\n\n"
         "    Collects traversal statistics per pixel.\n"
         "    The arguments represent the weight of traversal steps (t),\n"
@@ -119,7 +257,21 @@ static void usage()
         "  sweep_sah,\n"
         "  spatial_split,\n"
         "  locally_ordered_clustering,\n"
-        "  linear\n"
+        "  linear,\n"
+        "  hlbvh,\n"
+        "  aac,\n"
+        "  radix_tree\n"
+        "\nTraversers:\n"
+        "  single,\n"
+        "  packet4,\n"
+        "  packet8,\n"
+        "  packet16,\n"
+        "  wide4,\n"
+        "  wide8,\n"
+        "  compressed,\n"
+        "  stackless,\n"
+        "  octant,\n"
+        "  batched\n"
         << std::endl;
 }
 
@@ -159,13 +311,224 @@ public:
 };
 
 
-template <bool Permute, bool CollectStatistics>
-void render(
+enum class TraverserType
+{
+    Single,
+    Packet4,
+    Packet8,
+    Packet16,
+    Wide4,
+    Wide8,
+    Compressed,
+    Stackless,
+    Octant,
+    Batched
+};
+
+static std::optional<TraverserType> find_traverser_type(const char* name)
+{
+    if (!strcmp(name, "single"))   return TraverserType::Single;
+    if (!strcmp(name, "packet4"))  return TraverserType::Packet4;
+    if (!strcmp(name, "packet8"))  return TraverserType::Packet8;
+    if (!strcmp(name, "packet16")) return TraverserType::Packet16;
+    if (!strcmp(name, "wide4"))    return TraverserType::Wide4;
+    if (!strcmp(name, "wide8"))    return TraverserType::Wide8;
+    if (!strcmp(name, "compressed")) return TraverserType::Compressed;
+    if (!strcmp(name, "stackless"))  return TraverserType::Stackless;
+    if (!strcmp(name, "octant"))     return TraverserType::Octant;
+    if (!strcmp(name, "batched"))    return TraverserType::Batched;
+    return std::nullopt;
+}
+
+template <typename Traverser, typename = void>
+struct IsPacketTraverser : std::false_type {};
+
+template <typename Traverser>
+struct IsPacketTraverser<Traverser, std::void_t<decltype(Traverser::packet_size)>> : std::true_type {};
+
+template <typename Traverser>
+static constexpr bool is_packet_traverser = IsPacketTraverser<Traverser>::value;
+
+// Scene data given to the traversers. Wide and compressed BVHs, as well as parent
+// links, are only created when a traverser that needs them is selected.
+// When triangle blocks are present, leaves are intersected with them.
+struct RenderScene
+{
+    Bvh* bvh = nullptr;
+    const Triangle* triangles = nullptr;
+    bool permuted = false;
+    std::unique_ptr<Bvh::IndexType[]> parent_links;
+    std::unique_ptr<TriangleBlocks4> triangle_blocks4;
+    std::unique_ptr<TriangleBlocks8> triangle_blocks8;
+    std::unique_ptr<WideBvh4> wide_bvh4;
+    std::unique_ptr<WideBvh8> wide_bvh8;
+    std::unique_ptr<CompressedBvh> compressed_bvh;
+    // When present, rays are transformed into the space of the BVH instead of rebuilding it (see `--rotate`)
+    std::optional<AffineTransform> object_to_world;
+};
+
+template <typename WideBvh>
+static std::unique_ptr<WideBvh> collapse_bvh(const Bvh& bvh)
+{
+    auto wide_bvh = std::make_unique<WideBvh>();
+    bvh::WideBvhCollapser<Bvh, WideBvh::arity> collapser(*wide_bvh);
+    collapser.collapse(bvh);
+    return wide_bvh;
+}
+
+template <typename TriangleBlocks>
+static std::unique_ptr<TriangleBlocks> build_triangle_blocks(const RenderScene& scene)
+{
+    auto blocks = std::make_unique<TriangleBlocks>();
+    blocks->build(*scene.bvh, scene.triangles, scene.permuted);
+    return blocks;
+}
+
+static void prepare_scene(TraverserType traverser_type, size_t triangle_block_size, RenderScene& scene)
+{
+    if (triangle_block_size == 4 && !scene.triangle_blocks4)
+    {
+        profile("Triangle block construction", [&] { scene.triangle_blocks4 = build_triangle_blocks<TriangleBlocks4>(scene); });
+        Log("Triangle blocks : size = 4, blocks = {}", scene.triangle_blocks4->block_count);
+    }
+    else if (triangle_block_size == 8 && !scene.triangle_blocks8)
+    {
+        profile("Triangle block construction", [&] { scene.triangle_blocks8 = build_triangle_blocks<TriangleBlocks8>(scene); });
+        Log("Triangle blocks : size = 8, blocks = {}", scene.triangle_blocks8->block_count);
+    }
+
+    if (traverser_type == TraverserType::Wide4 && !scene.wide_bvh4)
+    {
+        profile("Wide BVH collapse", [&] { scene.wide_bvh4 = collapse_bvh<WideBvh4>(*scene.bvh); });
+        Log("Wide BVH : arity = 4, nodes = {}", scene.wide_bvh4->node_count);
+    }
+    else if (traverser_type == TraverserType::Wide8 && !scene.wide_bvh8)
+    {
+        profile("Wide BVH collapse", [&] { scene.wide_bvh8 = collapse_bvh<WideBvh8>(*scene.bvh); });
+        Log("Wide BVH : arity = 8, nodes = {}", scene.wide_bvh8->node_count);
+    }
+    else if (traverser_type == TraverserType::Compressed && !scene.compressed_bvh)
+    {
+        profile("BVH compression", [&] {
+            scene.compressed_bvh = std::make_unique<CompressedBvh>();
+            bvh::CompressedBvhConverter<Bvh> converter(*scene.compressed_bvh);
+            if (!converter.convert(*scene.bvh))
+                scene.compressed_bvh.reset();
+        });
+        if (!scene.compressed_bvh)
+        {
+            Log("The BVH cannot be compressed (leaves of more than {} primitives, or children outside of their parent), "
+                "falling back to the uncompressed BVH", CompressedBvh::max_leaf_size);
+            return;
+        }
+        auto node_count = scene.bvh->node_count;
+        Log("Compressed BVH : {} bytes/node ({:.2f} MB), uncompressed BVH : {} bytes/node ({:.2f} MB)",
+            sizeof(CompressedBvh::Node), node_count * sizeof(CompressedBvh::Node) / (1024.0 * 1024.0),
+            sizeof(Bvh::Node), node_count * sizeof(Bvh::Node) / (1024.0 * 1024.0));
+    }
+    else if (traverser_type == TraverserType::Stackless && !scene.parent_links)
+    {
+        profile("Parent link computation", [&] {
+            bvh::ParentLinkBuilder<Bvh> parent_link_builder(*scene.bvh);
+            scene.parent_links = parent_link_builder.build();
+        });
+        Log("Stackless traversal : {:.2f} MB of parent links, stack traversal : {} bytes of stack per ray",
+            scene.bvh->node_count * sizeof(Bvh::IndexType) / (1024.0 * 1024.0),
+            bvh::SingleRayTraverser<Bvh>::stack_size * sizeof(Bvh::IndexType));
+    }
+}
+
+// Returns the normal of the triangle that is hit.
+template <typename Hit>
+static Vector3 hit_normal(const Hit& hit, const Triangle* triangles)
+{
+    return triangles[hit.primitive_index].n;
+}
+
+// Returns the normal of the triangle that is hit, transformed into world space.
+template <typename Hit>
+static Vector3 hit_normal(const Hit& hit, const Instance* instances)
+{
+    auto& instance = instances[hit.instance_index];
+    return instance.normal_to_world(instance.primitives[hit.primitive_index].n);
+}
+
+// Triangles of a scene that is intersected with a `bvh::TransformedTraverser`.
+struct TransformedTriangles
+{
+    const Triangle* triangles;
+    const bvh::TransformedTraverser<Bvh>* traverser;
+};
+
+// Returns the normal of the triangle that is hit, transformed into world space.
+template <typename Hit>
+static Vector3 hit_normal(const Hit& hit, const TransformedTriangles& mesh)
+{
+    return mesh.traverser->normal_to_world(mesh.triangles[hit.primitive_index].n);
+}
+
+template <bool CollectStatistics, typename Hit, typename Primitives, typename Statistics>
+static void shade_pixel(
+    Scalar* pixel,
+    const std::optional<Hit>& hit,
+    const Primitives& primitives,
+    const Statistics& statistics,
+    const Scalar* statistics_weights)
+{
+    if (!hit)
+    {
+        pixel[0] = pixel[1] = pixel[2] = 0;
+    }
+    else
+    {
+        if (CollectStatistics)
+        {
+            auto combined = statistics.traversal_steps + statistics.intersections; 
+            pixel[0] = std::min(statistics.traversal_steps * statistics_weights[0], Scalar(1.0f));
+            pixel[1] = std::min(statistics.intersections   * statistics_weights[1], Scalar(1.0f));
+            pixel[2] = std::min(combined                   * statistics_weights[2], Scalar(1.0f));
+        }
+        else
+        {
+            auto normal = bvh::normalize(hit_normal(*hit, primitives));
+            pixel[0] = std::fabs(normal[0]);
+            pixel[1] = std::fabs(normal[1]);
+            pixel[2] = std::fabs(normal[2]);
+        }
+    }
+}
+
+// Tile timings and statistics of a rendering. They are only reported once the rendering is over,
+// so that logging them is not part of the measured time.
+struct RenderReport
+{
+    std::optional<TileScheduler> scheduler;
+    bool collect_statistics = false;
+    bool packets = false;
+    size_t traversal_steps = 0;
+    size_t intersections = 0;
+};
+
+static void report_rendering(const RenderReport& report)
+{
+    if (report.scheduler)
+        report.scheduler->Report();
+    if (report.collect_statistics)
+    {
+        Log("total primitive intersection(s) {}", report.intersections);
+        Log(report.packets ? "total packet traversal step(s) {}" : "total traversal step(s) {}", report.traversal_steps);
+    }
+}
+
+template <bool CollectStatistics, typename Traverser, typename Intersector, typename Primitives>
+RenderReport render(
     const Camera& camera,
-    const Bvh& bvh,
-    const Triangle* triangles,
+    const Traverser& traverser,
+    Intersector intersector,
+    const Primitives& primitives,
     Scalar* pixels,
     size_t width, size_t height,
+    size_t tile_size,
     const Scalar* statistics_weights = NULL)
 {
     //auto dir = bvh::normalize(camera.dir);
@@ -178,17 +541,16 @@ void render(
 
     CameraSampler cameraSampler(camera, width, height);
 
-    bvh::ClosestPrimitiveIntersector<Bvh, Triangle, Permute> intersector(bvh, triangles);
-    bvh::SingleRayTraverser<Bvh> traverser(bvh);
-
     size_t traversal_steps = 0, intersections = 0;
 
     // Log("{}", camera);
 
-    #pragma omp parallel for collapse(2) reduction(+: traversal_steps, intersections)
-    for(size_t i = 0; i < width; ++i)
+    // Pixels are traversed in Morton order within each tile, so that consecutive rays are coherent
+    TileScheduler scheduler(width, height, tile_size);
+    scheduler.Run([&] (const TileScheduler::Tile& tile)
     {
-        for(size_t j = 0; j < height; ++j)
+        size_t tile_traversal_steps = 0, tile_intersections = 0;
+        TileScheduler::ForEachPixel(tile, [&] (size_t i, size_t j)
         {
             size_t index = 3 * (width * j + i);
 
@@ -198,73 +560,709 @@ void render(
             //Ray ray(camera.eye, bvh::normalize(image_u * u + image_v * v + dir));
             Ray ray = cameraSampler.GenerateRay(u,v);
 
-            bvh::SingleRayTraverser<Bvh>::Statistics statistics;
+            typename Traverser::Statistics statistics;
             auto hit = CollectStatistics
                 ? traverser.traverse(ray, intersector, statistics)
                 : traverser.traverse(ray, intersector);
             if (CollectStatistics)
             {
+                tile_traversal_steps += statistics.traversal_steps;
+                tile_intersections   += statistics.intersections;
+            }
+
+            shade_pixel<CollectStatistics>(pixels + index, hit, primitives, statistics, statistics_weights);
+        });
+        if (CollectStatistics)
+        {
+            #pragma omp atomic
+            traversal_steps += tile_traversal_steps;
+            #pragma omp atomic
+            intersections += tile_intersections;
+        }
+    });
+
+    RenderReport report;
+    report.scheduler = std::move(scheduler);
+    report.collect_statistics = CollectStatistics;
+    report.traversal_steps = traversal_steps;
+    report.intersections = intersections;
+    return report;
+}
+
+// Renders the image with packets of PacketWidth x PacketHeight neighbouring pixels.
+// Statistics are collected per packet, so every pixel of a packet gets the same value.
+template <bool CollectStatistics, typename Traverser, typename Intersector>
+RenderReport render_packets(
+    const Camera& camera,
+    const Traverser& traverser,
+    Intersector intersector,
+    const Triangle* triangles,
+    Scalar* pixels,
+    size_t width, size_t height,
+    size_t tile_size,
+    const Scalar* statistics_weights = NULL)
+{
+    static constexpr size_t PacketSize    = Traverser::packet_size;
+    static constexpr size_t packet_width  = PacketSize == 4 ? 2 : 4;
+    static constexpr size_t packet_height = PacketSize / packet_width;
+
+    CameraSampler cameraSampler(camera, width, height);
+
+    size_t traversal_steps = 0, intersections = 0;
+
+    // Tiles are rounded up to a whole number of packets
+    tile_size = std::max(tile_size, packet_width);
+    tile_size = (tile_size + packet_width - 1) / packet_width * packet_width;
+
+    TileScheduler scheduler(width, height, tile_size);
+    scheduler.Run([&] (const TileScheduler::Tile& tile)
+    {
+        size_t tile_traversal_steps = 0, tile_intersections = 0;
+        for (size_t j = tile.y_begin; j < tile.y_end; j += packet_height)
+        {
+            for (size_t i = tile.x_begin; i < tile.x_end; i += packet_width)
+            {
+                Ray rays[PacketSize];
+                size_t indices[PacketSize];
+                size_t ray_count = 0;
+                for (size_t y = j; y < std::min(j + packet_height, tile.y_end); ++y)
+                {
+                    for (size_t x = i; x < std::min(i + packet_width, tile.x_end); ++x)
+                    {
+                        auto u = 2 * (x + Scalar(0.5)) / Scalar(width)  - Scalar(1);
+                        auto v = 2 * (y + Scalar(0.5)) / Scalar(height) - Scalar(1);
+                        indices[ray_count] = 3 * (width * y + x);
+                        rays[ray_count++] = cameraSampler.GenerateRay(u, v);
+                    }
+                }
+
+                std::optional<typename Intersector::Result> hits[PacketSize];
+                typename Traverser::Statistics statistics;
+                if (CollectStatistics)
+                {
+                    traverser.traverse(rays, ray_count, hits, intersector, statistics);
+                    tile_traversal_steps += statistics.traversal_steps;
+                    tile_intersections   += statistics.intersections;
+                }
+                else
+                    traverser.traverse(rays, ray_count, hits, intersector);
+
+                for (size_t k = 0; k < ray_count; ++k)
+                    shade_pixel<CollectStatistics>(pixels + indices[k], hits[k], triangles, statistics, statistics_weights);
+            }
+        }
+        if (CollectStatistics)
+        {
+            #pragma omp atomic
+            traversal_steps += tile_traversal_steps;
+            #pragma omp atomic
+            intersections += tile_intersections;
+        }
+    });
+
+    RenderReport report;
+    report.scheduler = std::move(scheduler);
+    report.collect_statistics = CollectStatistics;
+    report.packets = true;
+    report.traversal_steps = traversal_steps;
+    report.intersections = intersections;
+    return report;
+}
+
+// Traces the given rays, and returns the number of rays that hit the scene.
+// Packet traversers process packets of consecutive rays.
+template <bool CollectStatistics, typename Traverser, typename Intersector>
+size_t trace_rays(
+    const Traverser& traverser,
+    Intersector intersector,
+    const Ray* rays, size_t ray_count)
+{
+    size_t hit_count = 0, traversal_steps = 0, intersections = 0;
+
+    if constexpr (is_packet_traverser<Traverser>)
+    {
+        static constexpr size_t packet_size = Traverser::packet_size;
+        #pragma omp parallel for reduction(+: hit_count, traversal_steps, intersections)
+        for (size_t i = 0; i < ray_count; i += packet_size)
+        {
+            size_t count = std::min(packet_size, ray_count - i);
+            std::optional<typename Intersector::Result> hits[packet_size];
+            typename Traverser::Statistics statistics;
+            if (CollectStatistics)
+            {
+                traverser.traverse(rays + i, count, hits, intersector, statistics);
                 traversal_steps += statistics.traversal_steps;
                 intersections   += statistics.intersections;
             }
+            else
+                traverser.traverse(rays + i, count, hits, intersector);
+            for (size_t k = 0; k < count; ++k)
+                hit_count += hits[k] ? 1 : 0;
+        }
+    }
+    else
+    {
+        #pragma omp parallel for reduction(+: hit_count, traversal_steps, intersections)
+        for (size_t i = 0; i < ray_count; ++i)
+        {
+            typename Traverser::Statistics statistics;
+            auto hit = CollectStatistics
+                ? traverser.traverse(rays[i], intersector, statistics)
+                : traverser.traverse(rays[i], intersector);
+            if (CollectStatistics)
+            {
+                traversal_steps += statistics.traversal_steps;
+                intersections   += statistics.intersections;
+            }
+            hit_count += hit ? 1 : 0;
+        }
+    }
+
+    if (CollectStatistics)
+    {
+        Log("total primitive intersection(s) {}", intersections);
+        Log("total traversal step(s) {}", traversal_steps);
+    }
+    return hit_count;
+}
+
+// Calls `f(traverser)` with the traverser of the given type.
+template <typename F>
+static void visit_traverser(TraverserType traverser_type, const RenderScene& scene, F&& f)
+{
+    const Bvh& bvh = *scene.bvh;
+    switch (traverser_type)
+    {
+        case TraverserType::Packet4:    f(bvh::PacketTraverser<Bvh, 4>(bvh));  break;
+        case TraverserType::Packet8:    f(bvh::PacketTraverser<Bvh, 8>(bvh));  break;
+        case TraverserType::Packet16:   f(bvh::PacketTraverser<Bvh, 16>(bvh)); break;
+        case TraverserType::Wide4:      f(bvh::WideBvhTraverser<WideBvh4>(*scene.wide_bvh4)); break;
+        case TraverserType::Wide8:      f(bvh::WideBvhTraverser<WideBvh8>(*scene.wide_bvh8)); break;
+        case TraverserType::Compressed:
+            // The BVH cannot always be compressed (see `prepare_scene()`)
+            if (scene.compressed_bvh)
+                f(bvh::CompressedBvhTraverser<CompressedBvh>(*scene.compressed_bvh));
+            else
+                f(bvh::SingleRayTraverser<Bvh>(bvh));
+            break;
+        case TraverserType::Stackless:  f(bvh::StacklessTraverser<Bvh>(bvh, scene.parent_links.get())); break;
+        case TraverserType::Octant:     f(bvh::OctantTraverser<Bvh>(bvh)); break;
+        default:                        f(bvh::SingleRayTraverser<Bvh>(bvh)); break;
+    }
+}
+
+// Calls `f(intersector)` with the primitive intersector that matches the scene.
+// All the acceleration structures share the leaves (and primitive indices) of the
+// binary BVH, so the same primitive intersector can be used with every traverser.
+template <bool Permute, typename F>
+static void visit_intersector(const RenderScene& scene, F&& f)
+{
+    if (scene.triangle_blocks4)
+        f(bvh::TriangleBlockIntersector<Bvh, Triangle, 4, Permute>(*scene.bvh, *scene.triangle_blocks4));
+    else if (scene.triangle_blocks8)
+        f(bvh::TriangleBlockIntersector<Bvh, Triangle, 8, Permute>(*scene.bvh, *scene.triangle_blocks8));
+    else
+        f(bvh::ClosestPrimitiveIntersector<Bvh, Triangle, Permute>(*scene.bvh, scene.triangles));
+}
+
+// Calls `f(traverser, intersector)`. The scene must have been prepared
+// for the traverser with `prepare_scene()`.
+template <typename F>
+static void visit_traverser_and_intersector(TraverserType traverser_type, const RenderScene& scene, F&& f)
+{
+    auto visit = [&] (const auto& intersector)
+    {
+        visit_traverser(traverser_type, scene, [&] (const auto& traverser) { f(traverser, intersector); });
+    };
+    if (scene.permuted)
+        visit_intersector<true>(scene, visit);
+    else
+        visit_intersector<false>(scene, visit);
+}
+
+// Renders the image with a single call to the batched ray query API. Rays are generated
+// for packets of neighbouring pixels, so that the library can use packet traversal for them.
+template <typename Intersector>
+void render_batched(
+    const Camera& camera,
+    const Bvh& bvh,
+    const Intersector& intersector,
+    const Triangle* triangles,
+    Scalar* pixels,
+    size_t width, size_t height)
+{
+    using RayQueries = bvh::RayQueries<Bvh>;
+    static constexpr size_t packet_width  = RayQueries::packet_size == 4 ? 2 : 4;
+    static constexpr size_t packet_height = RayQueries::packet_size / packet_width;
+
+    CameraSampler cameraSampler(camera, width, height);
+
+    auto ray_count = width * height;
+    auto rays    = std::make_unique<Ray[]>(ray_count);
+    auto indices = std::make_unique<size_t[]>(ray_count);
+    auto hits    = std::make_unique<std::optional<typename Intersector::Result>[]>(ray_count);
+
+    size_t k = 0;
+    for (size_t i = 0; i < width; i += packet_width)
+    {
+        for (size_t j = 0; j < height; j += packet_height)
+        {
+            for (size_t y = j; y < std::min(j + packet_height, height); ++y)
+            {
+                for (size_t x = i; x < std::min(i + packet_width, width); ++x)
+                {
+                    auto u = 2 * (x + Scalar(0.5)) / Scalar(width)  - Scalar(1);
+                    auto v = 2 * (y + Scalar(0.5)) / Scalar(height) - Scalar(1);
+                    indices[k] = 3 * (width * y + x);
+                    rays[k++] = cameraSampler.GenerateRay(u, v);
+                }
+            }
+        }
+    }
+
+    RayQueries(bvh).intersect_rays(rays.get(), hits.get(), ray_count, intersector);
+
+    typename bvh::SingleRayTraverser<Bvh>::Statistics statistics;
+    #pragma omp parallel for
+    for (size_t i = 0; i < ray_count; ++i)
+        shade_pixel<false>(pixels + indices[i], hits[i], triangles, statistics, nullptr);
+}
+
+// Renders the image with the given traverser, and returns what should be reported about it.
+static RenderReport render_image(
+    TraverserType traverser_type,
+    bool collect_statistics,
+    const Camera& camera,
+    const RenderScene& scene,
+    Scalar* pixels,
+    size_t width, size_t height,
+    size_t tile_size,
+    const Scalar* statistics_weights)
+{
+    if (traverser_type == TraverserType::Batched)
+    {
+        if (collect_statistics)
+            Err("The batched traverser does not collect statistics");
+        auto render_with = [&] (const auto& intersector)
+        {
+            render_batched(camera, *scene.bvh, intersector, scene.triangles, pixels, width, height);
+        };
+        if (scene.permuted)
+            visit_intersector<true>(scene, render_with);
+        else
+            visit_intersector<false>(scene, render_with);
+        return RenderReport();
+    }
+
+    RenderReport report;
+
+    if (scene.object_to_world)
+    {
+        // Transformed scenes are only supported by the single-ray traverser
+        auto render_with = [&] (const auto& intersector)
+        {
+            bvh::TransformedTraverser<Bvh> traverser(bvh::SingleRayTraverser<Bvh>(*scene.bvh), *scene.object_to_world);
+            TransformedTriangles mesh { scene.triangles, &traverser };
+            report = collect_statistics
+                ? render<true >(camera, traverser, intersector, mesh, pixels, width, height, tile_size, statistics_weights)
+                : render<false>(camera, traverser, intersector, mesh, pixels, width, height, tile_size, statistics_weights);
+        };
+        if (scene.permuted)
+            visit_intersector<true>(scene, render_with);
+        else
+            visit_intersector<false>(scene, render_with);
+        return report;
+    }
+
+    visit_traverser_and_intersector(traverser_type, scene, [&] (const auto& traverser, const auto& intersector)
+    {
+        auto render_with = [&] (auto collect)
+        {
+            static constexpr bool CollectStatistics = decltype(collect)::value;
+            if constexpr (is_packet_traverser<std::decay_t<decltype(traverser)>>)
+                report = render_packets<CollectStatistics>(camera, traverser, intersector, scene.triangles, pixels, width, height, tile_size, statistics_weights);
+            else
+                report = render<CollectStatistics>(camera, traverser, intersector, scene.triangles, pixels, width, height, tile_size, statistics_weights);
+        };
+        if (collect_statistics)
+            render_with(std::true_type());
+        else
+            render_with(std::false_type());
+    });
+    return report;
+}
+
+// Traces rays with random origins inside the bounding box of the scene, and random directions.
+// These rays are incoherent, and therefore representative of secondary rays.
+static std::unique_ptr<Ray[]> generate_random_rays(const BoundingBox& bbox, size_t ray_count)
+{
+    auto rays = std::make_unique<Ray[]>(ray_count);
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<Scalar> distribution(0, 1);
+    for (size_t i = 0; i < ray_count; ++i)
+    {
+        Vector3 origin, direction;
+        for (int axis = 0; axis < 3; ++axis)
+            origin[axis] = bbox.min[axis] + distribution(generator) * (bbox.max[axis] - bbox.min[axis]);
+        auto z   = 2 * distribution(generator) - 1;
+        auto phi = distribution(generator) * Scalar(2 * 3.14159265359);
+        auto r   = std::sqrt(std::max(Scalar(0), 1 - z * z));
+        direction = Vector3(r * std::cos(phi), r * std::sin(phi), z);
+        rays[i] = Ray(origin, direction);
+    }
+    return rays;
+}
+
+static size_t trace_random_rays(
+    TraverserType traverser_type,
+    bool collect_statistics,
+    const RenderScene& scene,
+    const Ray* rays, size_t ray_count)
+{
+    size_t hit_count = 0;
+    if (traverser_type == TraverserType::Batched)
+    {
+        auto trace_with = [&] (const auto& intersector)
+        {
+            using Result = typename std::decay_t<decltype(intersector)>::Result;
+            auto hits = std::make_unique<std::optional<Result>[]>(ray_count);
+            bvh::RayQueries<Bvh>(*scene.bvh).intersect_rays(rays, hits.get(), ray_count, intersector);
+            hit_count = std::count_if(hits.get(), hits.get() + ray_count, [] (const auto& hit) { return hit.has_value(); });
+        };
+        if (scene.permuted)
+            visit_intersector<true>(scene, trace_with);
+        else
+            visit_intersector<false>(scene, trace_with);
+        return hit_count;
+    }
+
+    visit_traverser_and_intersector(traverser_type, scene, [&] (const auto& traverser, const auto& intersector)
+    {
+        hit_count = collect_statistics
+            ? trace_rays<true >(traverser, intersector, rays, ray_count)
+            : trace_rays<false>(traverser, intersector, rays, ray_count);
+    });
+    return hit_count;
+}
+
+// Generates `sample_count` ambient occlusion rays for every primary hit, with cosine-weighted
+// directions around the normal of the triangle that is hit, and a length of `radius`.
+// The rays of a pixel are consecutive, which is the order in which a renderer would emit them.
+template <typename Hit>
+static std::vector<Ray> generate_ao_rays(
+    const Ray* primary_rays,
+    const std::optional<Hit>* hits,
+    size_t primary_ray_count,
+    const Triangle* triangles,
+    size_t sample_count,
+    Scalar radius)
+{
+    static constexpr Scalar pi = Scalar(3.14159265359);
+    std::vector<Ray> rays;
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<Scalar> distribution(0, 1);
+    for (size_t i = 0; i < primary_ray_count; ++i)
+    {
+        if (!hits[i])
+            continue;
+        auto normal = bvh::normalize(triangles[hits[i]->primitive_index].n);
+        if (bvh::dot(normal, primary_rays[i].direction) > 0)
+            normal = -normal;
+        auto tangent   = bvh::normalize(std::fabs(normal[0]) > Scalar(0.5)
+            ? bvh::cross(normal, Vector3(0, 1, 0))
+            : bvh::cross(normal, Vector3(1, 0, 0)));
+        auto bitangent = bvh::cross(normal, tangent);
+        auto origin = primary_rays[i].origin + primary_rays[i].direction * hits[i]->distance() + normal * (radius * Scalar(1e-4));
+        for (size_t j = 0; j < sample_count; ++j)
+        {
+            auto r   = std::sqrt(distribution(generator));
+            auto phi = distribution(generator) * 2 * pi;
+            auto direction =
+                tangent   * (r * std::cos(phi)) +
+                bitangent * (r * std::sin(phi)) +
+                normal    * std::sqrt(std::max(Scalar(0), 1 - r * r));
+            rays.emplace_back(origin, direction, Scalar(0), radius);
+        }
+    }
+    return rays;
+}
+
+// Compares the throughput of occlusion queries for ambient occlusion rays, with and without ray sorting.
+template <bool Permute>
+static void benchmark_ao_rays(
+    const Camera& camera,
+    const RenderScene& scene,
+    size_t width, size_t height,
+    size_t sample_count)
+{
+    using ClosestIntersector = bvh::ClosestPrimitiveIntersector<Bvh, Triangle, Permute>;
+    using AnyIntersector     = bvh::AnyPrimitiveIntersector<Bvh, Triangle, Permute>;
+    using RayQueries         = bvh::RayQueries<Bvh>;
+
+    const Bvh& bvh = *scene.bvh;
+    RayQueries ray_queries(bvh);
+
+    CameraSampler cameraSampler(camera, width, height);
+    auto primary_ray_count = width * height;
+    auto primary_rays = std::make_unique<Ray[]>(primary_ray_count);
+    auto primary_hits = std::make_unique<std::optional<typename ClosestIntersector::Result>[]>(primary_ray_count);
+    for (size_t j = 0; j < height; ++j)
+    {
+        for (size_t i = 0; i < width; ++i)
+        {
+            auto u = 2 * (i + Scalar(0.5)) / Scalar(width)  - Scalar(1);
+            auto v = 2 * (j + Scalar(0.5)) / Scalar(height) - Scalar(1);
+            primary_rays[j * width + i] = cameraSampler.GenerateRay(u, v);
+        }
+    }
+    ray_queries.intersect_rays(primary_rays.get(), primary_hits.get(), primary_ray_count, ClosestIntersector(bvh, scene.triangles));
+
+    auto radius = bvh::length(bvh.nodes[0].bounding_box_proxy().to_bounding_box().diagonal()) * Scalar(0.1);
+    auto rays = generate_ao_rays(primary_rays.get(), primary_hits.get(), primary_ray_count, scene.triangles, sample_count, radius);
+    Log("{} ambient occlusion ray(s)", rays.size());
+
+    // Shuffled rays model a wavefront renderer, where the rays of a pixel are no longer next to each other
+    auto shuffled_rays = rays;
+    std::shuffle(shuffled_rays.begin(), shuffled_rays.end(), std::mt19937(42));
+
+    AnyIntersector intersector(bvh, scene.triangles);
+    auto occluded        = std::make_unique<bool[]>(rays.size());
+    auto sorted_occluded = std::make_unique<bool[]>(rays.size());
+    auto occlusion_test = [&] (const char* name, const std::vector<Ray>& rays, bool* occluded, bool sort_rays)
+    {
+        typename RayQueries::Options options;
+        options.kernel = RayQueries::Kernel::Single;
+        options.sort_rays = sort_rays;
+        auto time = profile(name, [&] {
+            ray_queries.occluded_rays(rays.data(), occluded, rays.size(), intersector, options);
+        });
+        return Scalar(rays.size()) / (time * Scalar(1000));
+    };
+
+    auto pixel_order_rate = occlusion_test("AO rays in pixel order", rays, occluded.get(), false);
+    auto pixel_sorted_rate = occlusion_test("Sorted AO rays in pixel order", rays, sorted_occluded.get(), true);
+    if (!std::equal(occluded.get(), occluded.get() + rays.size(), sorted_occluded.get()))
+        Err("Sorted and unsorted AO rays do not give the same results");
+    auto occluded_count = std::count(occluded.get(), occluded.get() + rays.size(), true);
+
+    auto shuffled_rate = occlusion_test("Shuffled AO rays", shuffled_rays, occluded.get(), false);
+    auto shuffled_sorted_rate = occlusion_test("Sorted shuffled AO rays", shuffled_rays, sorted_occluded.get(), true);
+    if (!std::equal(occluded.get(), occluded.get() + rays.size(), sorted_occluded.get()))
+        Err("Sorted and unsorted AO rays do not give the same results");
+
+    Log("Pixel order: {:.2f} Mrays/s unsorted, {:.2f} Mrays/s sorted (including sort)", pixel_order_rate, pixel_sorted_rate);
+    Log("Shuffled: {:.2f} Mrays/s unsorted, {:.2f} Mrays/s sorted (including sort)", shuffled_rate, shuffled_sorted_rate);
+    Log("{} occluded ray(s)", occluded_count);
+}
+
+// Returns a rotation of the given angle, in degrees, around the X (0), Y (1), or Z (2) axis.
+static AffineTransform axis_rotation(size_t axis, Scalar degrees)
+{
+    static constexpr Scalar pi = Scalar(3.14159265359);
+    Vector3 axis_vector(0);
+    axis_vector[axis] = 1;
+    return AffineTransform::rotation(axis_vector, degrees * pi / Scalar(180));
+}
+
+static void transform_triangles(const AffineTransform& transform, Triangle* triangles, size_t triangle_count)
+{
+    #pragma omp parallel for
+    for (size_t i = 0; i < triangle_count; ++i)
+    {
+        auto p0 = transform.transform_point(triangles[i].p0);
+        auto p1 = transform.transform_point(triangles[i].p1());
+        auto p2 = transform.transform_point(triangles[i].p2());
+        triangles[i] = Triangle(p0, p1, p2);
+    }
+}
+
+// Twists the scene around the vertical axis going through its center. The rotation angle
+// grows linearly with the height, from zero at the bottom to the given angle at the top.
+static void twist_triangles(Scalar degrees, const BoundingBox& bbox, const Triangle* input, Triangle* output, size_t triangle_count)
+{
+    static constexpr Scalar pi = Scalar(3.14159265359);
+    auto center = bbox.center();
+    auto height = std::max(bbox.max[1] - bbox.min[1], std::numeric_limits<Scalar>::min());
+    auto twist = [&] (const Vector3& p)
+    {
+        auto angle = degrees * pi / Scalar(180) * (p[1] - bbox.min[1]) / height;
+        auto cos = std::cos(angle);
+        auto sin = std::sin(angle);
+        auto x = p[0] - center[0];
+        auto z = p[2] - center[2];
+        return Vector3(center[0] + x * cos + z * sin, p[1], center[2] - x * sin + z * cos);
+    };
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < triangle_count; ++i)
+        output[i] = Triangle(twist(input[i].p0), twist(input[i].p1()), twist(input[i].p2()));
+}
+
+using BuilderFunction = std::function<size_t(Bvh&, const Triangle*, const BoundingBox&, const BoundingBox*, const Vector3*, size_t)>;
+
+// Animates the scene by twisting it a little more every frame, and compares three ways to update
+// the BVH: refitting it, refitting it with rotations, and rebuilding it with the given builder.
+static void benchmark_animation(
+    const Bvh& bvh,
+    const Triangle* triangles,
+    size_t triangle_count,
+    const BuilderFunction& builder,
+    size_t frame_count,
+    Scalar degrees_per_frame,
+    TraverserType traverser_type,
+    size_t triangle_block_size,
+    const Camera& camera,
+    size_t width, size_t height,
+    size_t tile_size)
+{
+    auto copy_bvh = [] (const Bvh& bvh, Bvh& copy)
+    {
+        size_t reference_count = 0;
+        for (size_t i = 0; i < bvh.node_count; ++i)
+            reference_count = std::max(reference_count, bvh.nodes[i].is_leaf() ? size_t(bvh.nodes[i].first_child_or_primitive + bvh.nodes[i].primitive_count) : 0);
+        copy.node_count = bvh.node_count;
+        copy.nodes = std::make_unique<Bvh::Node[]>(bvh.node_count);
+        copy.primitive_indices = std::make_unique<size_t[]>(reference_count);
+        std::copy(bvh.nodes.get(), bvh.nodes.get() + bvh.node_count, copy.nodes.get());
+        std::copy(bvh.primitive_indices.get(), bvh.primitive_indices.get() + reference_count, copy.primitive_indices.get());
+    };
+
+    Bvh refitted_bvh, rotated_bvh, rebuilt_bvh;
+    copy_bvh(bvh, refitted_bvh);
+    copy_bvh(bvh, rotated_bvh);
+    bvh::HierarchyRefitter<Bvh> refitter(refitted_bvh);
+    bvh::RotatingHierarchyRefitter<Bvh> rotating_refitter(rotated_bvh);
+
+    auto scene_bbox = bvh.nodes[0].bounding_box_proxy().to_bounding_box();
+    std::vector<Triangle> animated_triangles(triangle_count);
+    auto update_leaf = [&] (const Bvh& bvh)
+    {
+        return [&animated_triangles, primitive_indices = bvh.primitive_indices.get()] (Bvh::Node& leaf)
+        {
+            auto bbox = BoundingBox::empty();
+            for (size_t i = 0; i < leaf.primitive_count; ++i)
+                bbox.extend(animated_triangles[primitive_indices[leaf.first_child_or_primitive + i]].bounding_box());
+            leaf.bounding_box_proxy() = bbox;
+        };
+    };
+
+    std::unique_ptr<Scalar[]> pixels[3];
+    for (auto& buffer : pixels)
+        buffer = std::make_unique<Scalar[]>(3 * width * height);
+    auto render = [&] (const char* name, Bvh& bvh, Scalar* pixels)
+    {
+        RenderScene scene;
+        scene.bvh = &bvh;
+        scene.triangles = animated_triangles.data();
+        prepare_scene(traverser_type, triangle_block_size, scene);
+        auto time = profile(name, [&] {
+            render_image(traverser_type, false, camera, scene, pixels, width, height, tile_size, nullptr);
+        });
+        return Scalar(width * height) / (time * Scalar(1000));
+    };
 
-            if (!hit)
-            {
-                pixels[index] = pixels[index + 1] = pixels[index + 2] = 0;
-            }
-            else
-            {
-                if (CollectStatistics)
-                {
-                    auto combined = statistics.traversal_steps + statistics.intersections; 
-                    pixels[index    ] = std::min(statistics.traversal_steps * statistics_weights[0], Scalar(1.0f));
-                    pixels[index + 1] = std::min(statistics.intersections   * statistics_weights[1], Scalar(1.0f));
-                    pixels[index + 2] = std::min(combined                   * statistics_weights[2], Scalar(1.0f));
-                }
-                else
-                {
-                    auto normal = bvh::normalize(triangles[hit->primitive_index].n);
-                    pixels[index    ] = std::fabs(normal[0]);
-                    pixels[index + 1] = std::fabs(normal[1]);
-                    pixels[index + 2] = std::fabs(normal[2]);
-                }
-            }
+    for (size_t frame = 1; frame <= frame_count; ++frame)
+    {
+        twist_triangles(degrees_per_frame * frame, scene_bbox, triangles, animated_triangles.data(), triangle_count);
+
+        auto refit_time = profile("Refit", [&] { refitter.refit(update_leaf(refitted_bvh)); });
+        auto refit_cost = compute_sah_cost(refitted_bvh);
+        auto refit_rate = render("Rendering (refit)", refitted_bvh, pixels[0].get());
+
+        Scalar rotate_cost = 0;
+        auto rotate_time = profile("Refit with rotations", [&] { rotate_cost = rotating_refitter.refit(update_leaf(rotated_bvh)); });
+        auto rotate_rate = render("Rendering (refit with rotations)", rotated_bvh, pixels[1].get());
+
+        auto rebuild_time = profile("Rebuild", [&] {
+            auto [bboxes, centers] = bvh::compute_bounding_boxes_and_centers(animated_triangles.data(), animated_triangles.size());
+            auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), animated_triangles.size());
+            builder(rebuilt_bvh, animated_triangles.data(), global_bbox, bboxes.get(), centers.get(), animated_triangles.size());
+        });
+        auto rebuild_cost = compute_sah_cost(rebuilt_bvh);
+        auto rebuild_rate = render("Rendering (rebuild)", rebuilt_bvh, pixels[2].get());
+
+        Log("Frame {} ({:.1f} degrees):", frame, degrees_per_frame * frame);
+        Log("  refit:                {:8.2f} ms, SAH cost of {:.2f}, {:.2f} Mrays/s", refit_time, refit_cost, refit_rate);
+        Log("  refit with rotations: {:8.2f} ms, SAH cost of {:.2f} ({:.2f} initially), {:.2f} Mrays/s",
+            rotate_time, rotate_cost, rotating_refitter.get_initial_cost(), rotate_rate);
+        Log("  rebuild:              {:8.2f} ms, SAH cost of {:.2f}, {:.2f} Mrays/s", rebuild_time, rebuild_cost, rebuild_rate);
+
+        // All three hierarchies contain the same triangles, so the images should only differ
+        // on the few pixels where several triangles are hit at the same distance.
+        for (size_t i = 0; i < 2; ++i)
+        {
+            size_t different_pixel_count = 0;
+            for (size_t j = 0; j < width * height; ++j)
+                different_pixel_count += !std::equal(&pixels[i][3 * j], &pixels[i][3 * j + 3], &pixels[2][3 * j]);
+            if (different_pixel_count > 0)
+                Log("  {} pixel(s) differ between the images obtained after {} and after a rebuild",
+                    different_pixel_count, i == 0 ? "refitting" : "refitting with rotations");
         }
     }
+}
 
-    if (CollectStatistics)
+// Places copies of the mesh on a square grid, next to each other in the XZ plane. Every copy but the
+// first one, which keeps the original position of the mesh, is rotated around the vertical axis
+// going through the center of the mesh by a random angle.
+static std::vector<Instance> make_instance_grid(const Bvh& bvh, const Triangle* triangles, size_t instance_count)
+{
+    static constexpr Scalar pi = Scalar(3.14159265359);
+    auto bbox = bvh.nodes[0].bounding_box_proxy().to_bounding_box();
+    auto center = bbox.center();
+    auto diagonal = bbox.diagonal();
+    auto spacing = std::sqrt(diagonal[0] * diagonal[0] + diagonal[2] * diagonal[2]) * Scalar(1.1);
+    auto column_count = size_t(std::ceil(std::sqrt(Scalar(instance_count))));
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<Scalar> distribution(0, 2 * pi);
+    std::vector<Instance> instances;
+    instances.reserve(instance_count);
+    for (size_t i = 0; i < instance_count; ++i)
     {
-        Log("total primitive intersection(s) {}", intersections);
-        Log("total traversal step(s) {}", traversal_steps);
-        //std::cout << intersections << " total primitive intersection(s)" << std::endl;
-        //std::cout << traversal_steps << " total traversal step(s)" << std::endl;
+        auto angle = i == 0 ? Scalar(0) : distribution(generator);
+        auto offset = Vector3(Scalar(i % column_count) * spacing, 0, -Scalar(i / column_count) * spacing);
+        auto transform =
+            AffineTransform::translation(center + offset) *
+            AffineTransform::rotation(Vector3(0, 1, 0), angle) *
+            AffineTransform::translation(-center);
+        instances.emplace_back(bvh, triangles, transform);
     }
+    return instances;
 }
 
-template <size_t Axis>
-static void rotate_triangles(Scalar degrees, Triangle* triangles, size_t triangle_count)
+static void build_top_level_bvh(Bvh& top_bvh, const std::vector<Instance>& instances)
 {
-    static constexpr Scalar pi = Scalar(3.14159265359);
-    auto cos = std::cos(degrees * pi / Scalar(180));
-    auto sin = std::sin(degrees * pi / Scalar(180));
-    auto rotate = [&] (const Vector3& p)
-    {
-        if (Axis == 0)
-            return Vector3(p[0], p[1] * cos - p[2] * sin, p[1] * sin + p[2] * cos);
-        else if (Axis == 1)
-            return Vector3(p[0] * cos + p[2] * sin, p[1], -p[0] * sin + p[2] * cos);
-        else
-            return Vector3(p[0] * cos - p[1] * sin, p[0] * sin + p[1] * cos, p[2]);
-    };
+    auto [bboxes, centers] = bvh::compute_bounding_boxes_and_centers(instances.data(), instances.size());
+    auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), instances.size());
+    bvh::BinnedSahBuilder<Bvh, 16> builder(top_bvh);
+    builder.build(global_bbox, bboxes.get(), centers.get(), instances.size());
+}
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < triangle_count; ++i)
+// Renders the image with a two-level acceleration structure: the top-level BVH is traversed
+// with a single-ray traverser, which transforms the ray and traverses the BVH of the mesh
+// every time it reaches an instance.
+static RenderReport render_instances(
+    const Bvh& top_bvh,
+    const Instance* instances,
+    bool permuted,
+    bool collect_statistics,
+    const Camera& camera,
+    Scalar* pixels,
+    size_t width, size_t height,
+    size_t tile_size,
+    const Scalar* statistics_weights)
+{
+    auto render_with = [&] (auto permute)
     {
-        auto p0 = rotate(triangles[i].p0);
-        auto p1 = rotate(triangles[i].p1());
-        auto p2 = rotate(triangles[i].p2());
-        triangles[i] = Triangle(p0, p1, p2);
-    }
+        bvh::SingleRayTraverser<Bvh> traverser(top_bvh);
+        bvh::ClosestInstanceIntersector<Bvh, Triangle, decltype(permute)::value> intersector(top_bvh, instances);
+        return collect_statistics
+            ? render<true >(camera, traverser, intersector, instances, pixels, width, height, tile_size, statistics_weights)
+            : render<false>(camera, traverser, intersector, instances, pixels, width, height, tile_size, statistics_weights);
+    };
+    return permuted
+        ? render_with(std::true_type())
+        : render_with(std::false_type());
 }
 
 int EntryPointMain(int argc, char** argv)
@@ -278,6 +1276,14 @@ int EntryPointMain(int argc, char** argv)
     const char* output_file  = "render.ppm";
     const char* input_file   = NULL;
     const char* builder_name = "binned_sah";
+    const char* traverser_name = "single";
+    const char* binning_name = "node";
+    size_t bin_count = 0;
+    size_t morton_bits = 32;
+    const char* bin_schedule_name = "";
+    const char* bvh_cache_dir = NULL;
+    bvh::BinSchedule bin_schedule;
+    std::unique_ptr<bvh::WorkStealingExecutor> executor;
     Camera camera =
     {
         Vector3(0, 0.9, 2.5),
@@ -288,15 +1294,25 @@ int EntryPointMain(int argc, char** argv)
     bool permute = false;
     bool optimize_layout = false;
     bool parallel_reinsertion = false;
+    bool treelet_restructuring = false;
     bool collapse_leaves = false;
     size_t build_iterations = 1;
+    size_t triangle_block_size = 0;
+    size_t random_ray_count = 0;
+    size_t dynamic_update_count = 0;
+    size_t animation_frame_count = 0;
+    Scalar animation_degrees = 10;
+    size_t instance_count = 0;
+    size_t ao_sample_count = 0;
     Scalar pre_split_factor = 0;
     bool collect_statistics = false;
     size_t rotation_axis = 3;
     Scalar rotation_degrees = 0;
+    bool rotate_triangles = false;
     Scalar statistics_weights[3];
     size_t width  = 1280;
     size_t height = 720;
+    size_t tile_size = default_tile_size;
     for (int i = 1; i < argc; ++i) {
         if (argv[i][0] == '-') {
             if (!strcmp(argv[i], "--help")) {
@@ -330,12 +1346,87 @@ int EntryPointMain(int argc, char** argv)
                 if (i + 1 >= argc)
                     return not_enough_arguments(argv[i]);
                 builder_name = argv[++i];
+            } else if (!strcmp(argv[i], "--binning")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                binning_name = argv[++i];
+            } else if (!strcmp(argv[i], "--bins")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                bin_count = strtoull(argv[++i], NULL, 10);
+                if (bin_count < 2 || bin_count > max_bin_count) {
+                    std::cerr << "Invalid number of bins (must be between 2 and " << max_bin_count << ")." << std::endl;
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--morton-bits")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                morton_bits = strtoull(argv[++i], NULL, 10);
+                if (morton_bits != 32 && morton_bits != 64) {
+                    std::cerr << "Invalid Morton code width (must be 32 or 64)." << std::endl;
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--bin-schedule")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                bin_schedule_name = argv[++i];
+                if (!parse_bin_schedule(bin_schedule_name, bin_schedule)) {
+                    std::cerr << "Invalid bin schedule." << std::endl;
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--work-stealing")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                executor = std::make_unique<bvh::WorkStealingExecutor>(strtoull(argv[++i], NULL, 10));
+            } else if (!strcmp(argv[i], "--traverser")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                traverser_name = argv[++i];
+            } else if (!strcmp(argv[i], "--triangle-blocks")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                triangle_block_size = strtoull(argv[++i], NULL, 10);
+                if (triangle_block_size != 4 && triangle_block_size != 8) {
+                    std::cerr << "Invalid triangle block size (must be 4 or 8)." << std::endl;
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--tile-size")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                tile_size = strtoull(argv[++i], NULL, 10);
+            } else if (!strcmp(argv[i], "--ao-rays")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                ao_sample_count = strtoull(argv[++i], NULL, 10);
+            } else if (!strcmp(argv[i], "--random-rays")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                random_ray_count = strtoull(argv[++i], NULL, 10);
+            } else if (!strcmp(argv[i], "--dynamic-updates")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                dynamic_update_count = strtoull(argv[++i], NULL, 10);
+            } else if (!strcmp(argv[i], "--animate")) {
+                if (i + 2 >= argc)
+                    return not_enough_arguments(argv[i]);
+                animation_frame_count = strtoull(argv[++i], NULL, 10);
+                animation_degrees = strtof(argv[++i], NULL);
+            } else if (!strcmp(argv[i], "--bvh-cache")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                bvh_cache_dir = argv[++i];
+            } else if (!strcmp(argv[i], "--instances")) {
+                if (i + 1 >= argc)
+                    return not_enough_arguments(argv[i]);
+                instance_count = strtoull(argv[++i], NULL, 10);
             } else if (!strcmp(argv[i], "--permute")) {
                 permute = true;
             } else if (!strcmp(argv[i], "--optimize-layout")) {
                 optimize_layout = true;
             } else if (!strcmp(argv[i], "--parallel-reinsertion")) {
                 parallel_reinsertion = true;
+            } else if (!strcmp(argv[i], "--treelet-restructuring")) {
+                treelet_restructuring = true;
             } else if (!strcmp(argv[i], "--collapse-leaves")) {
                 collapse_leaves = true;
             } else if (!strcmp(argv[i], "--pre-split")) {
@@ -354,9 +1445,10 @@ int EntryPointMain(int argc, char** argv)
                     std::cerr << "Invalid number of construction iterations." << std::endl;
                     return 1;
                 }
-            } else if (!strcmp(argv[i], "--rotate")) {
+            } else if (!strcmp(argv[i], "--rotate") || !strcmp(argv[i], "--rotate-triangles")) {
                 if (i + 2 >= argc)
                     return not_enough_arguments(argv[i]);
+                rotate_triangles = !strcmp(argv[i], "--rotate-triangles");
                 rotation_axis = argv[++i][0] - 'x';
                 rotation_degrees = strtof(argv[++i], NULL);
                 if (rotation_axis > 2) {
@@ -398,52 +1490,147 @@ int EntryPointMain(int argc, char** argv)
         return 1;
     }
 
-    std::function<size_t(Bvh&, const Triangle*, const BoundingBox&, const BoundingBox*, const Vector3*, size_t)> builder;
+    auto traverser_type = find_traverser_type(traverser_name);
+    if (!traverser_type)
+    {
+        std::cerr << "Unknown traverser name" << std::endl;
+        return 1;
+    }
+
+    if (instance_count > 0 && (
+        *traverser_type != TraverserType::Single || triangle_block_size > 0 ||
+        animation_frame_count > 0 || random_ray_count > 0 || ao_sample_count > 0))
+    {
+        std::cerr << "Instances are only supported when rendering images with the 'single' traverser, without triangle blocks" << std::endl;
+        return 1;
+    }
+
+    if (rotation_axis < 3 && !rotate_triangles && (
+        *traverser_type != TraverserType::Single || instance_count > 0 ||
+        animation_frame_count > 0 || random_ray_count > 0 || ao_sample_count > 0))
+    {
+        std::cerr << "'--rotate' is only supported when rendering images with the 'single' traverser (see '--rotate-triangles')" << std::endl;
+        return 1;
+    }
+
+    if (strcmp(binning_name, "node") && strcmp(binning_name, "center") && strcmp(binning_name, "simd"))
+    {
+        std::cerr << "Unknown binning mode" << std::endl;
+        return 1;
+    }
+
+    // Completes the bin schedule with the bin count of the builder for the depths it does not cover
+    auto make_bin_schedule = [&] (size_t default_bin_count)
+    {
+        auto schedule = bin_schedule;
+        if (schedule.bin_count(0, 0) == 0)
+            schedule.set(0, bin_count ? bin_count : default_bin_count);
+        return schedule;
+    };
+
+    BuilderFunction builder;
     if (!strcmp(builder_name, "binned_sah"))
     {
-        builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        builder = [binning_name, schedule = make_bin_schedule(16), executor = executor.get()] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
         {
             PROFILER_MARKER(binned_sah_build);
-            static constexpr size_t bin_count = 16; // how to set a efficiency value ?
-            bvh::BinnedSahBuilder<Bvh, bin_count> builder(bvh);
-            builder.build(global_bbox, bboxes, centers, primitive_count);
+            with_max_bin_count(schedule.max_bin_count(), [&] (auto max_bins)
+            {
+                using BinnedSahBuilder = bvh::BinnedSahBuilder<Bvh, decltype(max_bins)::value>;
+                BinnedSahBuilder builder(bvh);
+                builder.binning = find_binning<BinnedSahBuilder>(binning_name);
+                builder.bin_schedule = schedule;
+                builder.executor = executor;
+                builder.build(global_bbox, bboxes, centers, primitive_count);
+            });
             return primitive_count;
         };
     }
     else if (!strcmp(builder_name, "sweep_sah"))
     {
-        builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        builder = [executor = executor.get()] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
         {
             bvh::SweepSahBuilder<Bvh> builder(bvh);
+            builder.executor = executor;
             builder.build(global_bbox, bboxes, centers, primitive_count);
             return primitive_count;
         };
     }
     else if (!strcmp(builder_name, "spatial_split"))
     {
-        builder = [] (Bvh& bvh, const Triangle* triangles, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        builder = [schedule = make_bin_schedule(64), executor = executor.get()] (Bvh& bvh, const Triangle* triangles, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
         {
-            static constexpr size_t bin_count = 64;
-            bvh::SpatialSplitBvhBuilder<Bvh, Triangle, bin_count> builder(bvh);
-            return builder.build(global_bbox, triangles, bboxes, centers, primitive_count);
+            return with_max_bin_count(schedule.max_bin_count(), [&] (auto max_bins)
+            {
+                bvh::SpatialSplitBvhBuilder<Bvh, Triangle, decltype(max_bins)::value> builder(bvh);
+                builder.bin_schedule = schedule;
+                builder.executor = executor;
+                return builder.build(global_bbox, triangles, bboxes, centers, primitive_count);
+            });
         };
     }
     else if (!strcmp(builder_name, "locally_ordered_clustering"))
     {
-        builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        builder = [morton_bits] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
         {
-            using Morton = uint32_t;
-            bvh::LocallyOrderedClusteringBuilder<Bvh, Morton> builder(bvh);
-            builder.build(global_bbox, bboxes, centers, primitive_count);
+            with_morton_type(morton_bits, [&] (auto morton)
+            {
+                using Morton = decltype(morton);
+                bvh::LocallyOrderedClusteringBuilder<Bvh, Morton> builder(bvh);
+                builder.build(global_bbox, bboxes, centers, primitive_count);
+            });
             return primitive_count;
         };
     }
     else if (!strcmp(builder_name, "linear"))
     {
-        builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count) {
-            using Morton = uint32_t;
-            bvh::LinearBvhBuilder<Bvh, Morton> builder(bvh);
-            builder.build(global_bbox, bboxes, centers, primitive_count);
+        builder = [morton_bits] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        {
+            with_morton_type(morton_bits, [&] (auto morton)
+            {
+                using Morton = decltype(morton);
+                bvh::LinearBvhBuilder<Bvh, Morton> builder(bvh);
+                builder.build(global_bbox, bboxes, centers, primitive_count);
+            });
+            return primitive_count;
+        };
+    }
+    else if (!strcmp(builder_name, "hlbvh"))
+    {
+        builder = [morton_bits] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        {
+            with_morton_type(morton_bits, [&] (auto morton)
+            {
+                using Morton = decltype(morton);
+                bvh::HierarchicalLinearBvhBuilder<Bvh, Morton> builder(bvh);
+                builder.build(global_bbox, bboxes, centers, primitive_count);
+            });
+            return primitive_count;
+        };
+    }
+    else if (!strcmp(builder_name, "aac"))
+    {
+        builder = [morton_bits] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        {
+            with_morton_type(morton_bits, [&] (auto morton)
+            {
+                using Morton = decltype(morton);
+                bvh::ApproximateAgglomerativeClusteringBuilder<Bvh, Morton> builder(bvh);
+                builder.build(global_bbox, bboxes, centers, primitive_count);
+            });
+            return primitive_count;
+        };
+    }
+    else if (!strcmp(builder_name, "radix_tree"))
+    {
+        builder = [morton_bits] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        {
+            with_morton_type(morton_bits, [&] (auto morton)
+            {
+                using Morton = decltype(morton);
+                bvh::RadixTreeBvhBuilder<Bvh, Morton> builder(bvh);
+                builder.build(global_bbox, bboxes, centers, primitive_count);
+            });
             return primitive_count;
         };
     }
@@ -453,91 +1640,279 @@ int EntryPointMain(int argc, char** argv)
         return 1;
     }
 
-    // Load mesh from file
-    auto triangles = obj::load_from_file(input_file);
-    if (triangles.size() == 0)
+    // Cache files are identified by the contents of the scene and by every option that changes the BVH
+    std::unique_ptr<bvh_cache::MappedBvh> cached_bvh;
+    std::string bvh_cache_file, build_options;
+    uint64_t mesh_hash = 0;
+    if (bvh_cache_dir)
     {
-        std::cerr << "The given scene is empty or cannot be loaded" << std::endl;
-        return 1;
+        if (dynamic_update_count > 0 || animation_frame_count > 0)
+        {
+            std::cerr << "The BVH cache cannot be combined with dynamic updates or animations" << std::endl;
+            return 1;
+        }
+
+        std::ostringstream options;
+        options
+            << builder_name
+            << " binning=" << binning_name
+            << " bins=" << bin_count
+            << " bin-schedule=" << bin_schedule_name
+            << " morton-bits=" << morton_bits
+            << " pre-split=" << pre_split_factor
+            << " treelet-restructuring=" << treelet_restructuring
+            << " parallel-reinsertion=" << parallel_reinsertion
+            << " optimize-layout=" << optimize_layout
+            << " collapse-leaves=" << collapse_leaves
+            << " triangle-blocks=" << (collapse_leaves ? triangle_block_size : 0)
+            << " permute=" << permute;
+        if (rotation_axis < 3 && rotate_triangles)
+            options << " rotate-triangles=" << char('x' + rotation_axis) << ":" << rotation_degrees;
+        build_options = options.str();
+
+        bool hashed = false;
+        profile("Scene hashing", [&] { hashed = bvh_cache::hash_file(input_file, mesh_hash); });
+        if (!hashed)
+        {
+            std::cerr << "The given scene is empty or cannot be loaded" << std::endl;
+            return 1;
+        }
+        bvh_cache_file = bvh_cache::file_name(bvh_cache_dir, mesh_hash, build_options);
+        profile("BVH cache loading", [&] { cached_bvh = bvh_cache::load(bvh_cache_file, mesh_hash, build_options); });
     }
 
-    // Rotate triangles if requested
-    if (rotation_axis == 0)
-        rotate_triangles<0>(rotation_degrees, triangles.data(), triangles.size());
-    else if (rotation_axis == 1)
-        rotate_triangles<1>(rotation_degrees, triangles.data(), triangles.size());
-    else if (rotation_axis == 2)
-        rotate_triangles<2>(rotation_degrees, triangles.data(), triangles.size());
+    // Load mesh from file, unless the BVH and the triangles come from the cache.
+    // Binary meshes (see obj2bin) are mapped into memory, and their triangles are used in place.
+    std::unique_ptr<binary_mesh::MappedMesh> mapped_mesh;
+    std::vector<Triangle> loaded_triangles;
+    Triangle* triangles = nullptr;
+    size_t triangle_count = 0;
+    if (!cached_bvh)
+    {
+        auto loading_time = profile("Scene loading", [&] {
+            mapped_mesh = binary_mesh::load(input_file);
+            if (!mapped_mesh)
+                loaded_triangles = obj::load_from_file(input_file);
+        });
+        triangles      = mapped_mesh ? mapped_mesh->triangles      : loaded_triangles.data();
+        triangle_count = mapped_mesh ? mapped_mesh->triangle_count : loaded_triangles.size();
+        if (triangle_count == 0)
+        {
+            std::cerr << "The given scene is empty or cannot be loaded" << std::endl;
+            return 1;
+        }
+        std::error_code error;
+        auto file_size = std::filesystem::file_size(input_file, error);
+        Log("{} triangle(s) loaded at {:.2f} GB/s{}", triangle_count, error ? 0.0 : file_size / (loading_time * 1.0e6),
+            mapped_mesh ? " (binary mesh, mapped into memory)" : "");
+    }
 
-    Bvh bvh;
+    // Rotate triangles if requested (rotations of the rays are applied when rendering)
+    if (rotation_axis < 3 && rotate_triangles)
+        transform_triangles(axis_rotation(rotation_axis, rotation_degrees), triangles, triangle_count);
 
-    size_t reference_count = triangles.size();
+    Bvh built_bvh;
+    Bvh& bvh = cached_bvh ? cached_bvh->bvh : built_bvh;
+
+    size_t reference_count = cached_bvh ? cached_bvh->reference_count : triangle_count;
+    size_t scene_triangle_count = cached_bvh ? cached_bvh->triangle_count : triangle_count;
     std::unique_ptr<Triangle[]> shuffled_triangles;
 
-    // Build an acceleration data structure for this object set
-    std::cout << "Building BVH (" << builder_name;
-    if (pre_split_factor)
-        std::cout << " + pre-split";
-    if (parallel_reinsertion)
-        std::cout << " + parallel-reinsertion";
-    if (optimize_layout)
-        std::cout << " + optimize-layout";
-    if (collapse_leaves)
-        std::cout << " + collapse-leaves";
-    if (permute)
-        std::cout << " + permute";
-    std::cout << ")..." << std::endl;
-    profile("BVH construction", [&] {
-        auto [bboxes, centers] =
-            bvh::compute_bounding_boxes_and_centers(triangles.data(), triangles.size());
-        auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), triangles.size());
-        bvh::HeuristicPrimitiveSplitter<Triangle> splitter;
-        if (pre_split_factor > 0)
-            std::tie(reference_count, bboxes, centers) = splitter.split(global_bbox, triangles.data(), triangles.size(), pre_split_factor);
-        reference_count = builder(bvh, triangles.data(), global_bbox, bboxes.get(), centers.get(), reference_count);
-        if (pre_split_factor > 0)
-            splitter.repair_bvh_leaves(bvh);
-        if (parallel_reinsertion) {
-            bvh::ParallelReinsertionOptimizer<Bvh> reinsertion_optimizer(bvh);
-            reinsertion_optimizer.optimize();
-        }
-        if (optimize_layout) {
-            bvh::NodeLayoutOptimizer layout_optimizer(bvh);
-            layout_optimizer.optimize();
+    if (cached_bvh)
+        std::cout << "Loaded BVH from '" << bvh_cache_file << "' (" << build_options << ")" << std::endl;
+    else
+    {
+        std::cout << "Building BVH (" << builder_name;
+        if (pre_split_factor)
+            std::cout << " + pre-split";
+        if (treelet_restructuring)
+            std::cout << " + treelet-restructuring";
+        if (parallel_reinsertion)
+            std::cout << " + parallel-reinsertion";
+        if (optimize_layout)
+            std::cout << " + optimize-layout";
+        if (collapse_leaves)
+            std::cout << " + collapse-leaves";
+        if (permute)
+            std::cout << " + permute";
+        std::cout << ")..." << std::endl;
+        profile("BVH construction", [&] {
+            auto [bboxes, centers] =
+                bvh::compute_bounding_boxes_and_centers(triangles, triangle_count);
+            auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), triangle_count);
+            bvh::HeuristicPrimitiveSplitter<Triangle> splitter;
+            if (pre_split_factor > 0)
+                std::tie(reference_count, bboxes, centers) = splitter.split(global_bbox, triangles, triangle_count, pre_split_factor);
+            reference_count = builder(bvh, triangles, global_bbox, bboxes.get(), centers.get(), reference_count);
+            if (pre_split_factor > 0)
+                splitter.repair_bvh_leaves(bvh);
+            if (treelet_restructuring) {
+                bvh::TreeletRestructuringOptimizer<Bvh> restructuring_optimizer(bvh);
+                restructuring_optimizer.optimize();
+            }
+            if (parallel_reinsertion) {
+                bvh::ParallelReinsertionOptimizer<Bvh> reinsertion_optimizer(bvh);
+                reinsertion_optimizer.optimize();
+            }
+            if (optimize_layout) {
+                bvh::NodeLayoutOptimizer layout_optimizer(bvh);
+                layout_optimizer.optimize();
+            }
+            if (collapse_leaves) {
+                bvh::LeafCollapser leaf_collapser(bvh);
+                // A block of triangles costs about as much as a single triangle
+                if (triangle_block_size > 0)
+                    leaf_collapser.traversal_cost = Scalar(triangle_block_size);
+                leaf_collapser.collapse();
+            }
+            if (permute)
+                shuffled_triangles = bvh::permute_primitives(triangles, bvh.primitive_indices.get(), reference_count);
+        }, build_iterations);
+
+        if (bvh_cache_dir)
+        {
+            bool saved = false;
+            profile("BVH cache writing", [&] {
+                saved = bvh_cache::save(
+                    bvh_cache_file, bvh, reference_count,
+                    permute ? shuffled_triangles.get() : triangles,
+                    permute ? reference_count : triangle_count,
+                    permute, mesh_hash, build_options);
+            });
+            if (!saved)
+                std::cerr << "Could not write the BVH cache file '" << bvh_cache_file << "'" << std::endl;
         }
-        if (collapse_leaves) {
-            bvh::LeafCollapser leaf_collapser(bvh);
-            leaf_collapser.collapse();
+    }
+
+    if (dynamic_update_count > 0)
+    {
+        if (permute || pre_split_factor > 0)
+        {
+            std::cerr << "Dynamic updates require every triangle to be referenced once, in the original order" << std::endl;
+            return 1;
         }
-        if (permute)
-            shuffled_triangles = bvh::permute_primitives(triangles.data(), bvh.primitive_indices.get(), reference_count);
-    }, build_iterations);
 
-    // This is just to make sure that refitting works
-    bvh::HierarchyRefitter refitter(bvh);
-    refitter.refit([] (Bvh::Node&) {});
+        // Simulate an edit of the scene, where some triangles are deleted and then added back
+        dynamic_update_count = std::min(dynamic_update_count, triangle_count);
+        std::vector<size_t> updated_triangles(triangle_count);
+        std::iota(updated_triangles.begin(), updated_triangles.end(), 0);
+        std::shuffle(updated_triangles.begin(), updated_triangles.end(), std::mt19937(42));
+        updated_triangles.resize(dynamic_update_count);
+
+        auto bboxes = bvh::compute_bounding_boxes_and_centers(triangles, triangle_count).first;
+        bvh::DynamicBvhUpdater<Bvh> updater(bvh, bboxes.get());
+        std::cout << "Updating " << dynamic_update_count << " triangle(s)..." << std::endl;
+        profile("Dynamic updates", [&] {
+            for (auto i : updated_triangles)
+                updater.remove(i);
+            for (auto i : updated_triangles)
+                updater.insert(i, bboxes[i]);
+        });
+        reference_count = triangle_count;
+    }
+
+    // This is just to make sure that refitting works (not on a cached BVH,
+    // since writing to every node would make a private copy of the whole mapping)
+    if (!cached_bvh)
+    {
+        bvh::HierarchyRefitter refitter(bvh);
+        refitter.refit([] (Bvh::Node&) {});
+    }
 
     std::cout
         << "BVH depth of " << compute_bvh_depth(bvh) << ", "
         << bvh.node_count << " node(s), "
-        << reference_count << " reference(s)" << std::endl;
+        << reference_count << " reference(s), "
+        << "SAH cost of " << compute_sah_cost(bvh) << std::endl;
+
+    RenderScene scene;
+    scene.bvh = &bvh;
+    scene.triangles = cached_bvh ? cached_bvh->triangles : permute ? shuffled_triangles.get() : triangles;
+    scene.permuted = permute;
+    if (rotation_axis < 3 && !rotate_triangles)
+        scene.object_to_world = axis_rotation(rotation_axis, rotation_degrees);
+    prepare_scene(*traverser_type, triangle_block_size, scene);
+
+    if (animation_frame_count > 0)
+    {
+        if (permute)
+        {
+            std::cerr << "Animations cannot be combined with primitive permutation" << std::endl;
+            return 1;
+        }
+        std::cout << "Animating the scene over " << animation_frame_count << " frame(s) (" << traverser_name << ")..." << std::endl;
+        benchmark_animation(
+            bvh, triangles, triangle_count, builder,
+            animation_frame_count, animation_degrees,
+            *traverser_type, triangle_block_size,
+            camera, width, height, tile_size);
+        return 0;
+    }
+
+    if (random_ray_count > 0)
+    {
+        auto rays = generate_random_rays(bvh.nodes[0].bounding_box_proxy(), random_ray_count);
+        size_t hit_count = 0;
+        std::cout << "Tracing " << random_ray_count << " random rays (" << traverser_name << ")..." << std::endl;
+        auto tracing_time = profile("Random rays", [&] {
+            hit_count = trace_random_rays(*traverser_type, collect_statistics, scene, rays.get(), random_ray_count);
+        });
+        Log("{:.2f} Mrays/s, {} hit(s)", Scalar(random_ray_count) / (tracing_time * Scalar(1000)), hit_count);
+        return 0;
+    }
+
+    if (ao_sample_count > 0)
+    {
+        std::cout << "Tracing " << ao_sample_count << " ambient occlusion ray(s) per pixel (" << width << "x" << height << ")..." << std::endl;
+        if (scene.permuted)
+            benchmark_ao_rays<true >(camera, scene, width, height, ao_sample_count);
+        else
+            benchmark_ao_rays<false>(camera, scene, width, height, ao_sample_count);
+        return 0;
+    }
+
+    // Copies of the scene share its BVH, and only need a top-level BVH over them
+    std::vector<Instance> instances;
+    Bvh top_bvh;
+    if (instance_count > 0)
+    {
+        instances = make_instance_grid(bvh, scene.triangles, instance_count);
+        profile("Top-level BVH construction", [&] { build_top_level_bvh(top_bvh, instances); });
+        auto mesh_size =
+            bvh.node_count * sizeof(Bvh::Node) +
+            reference_count * sizeof(size_t) +
+            scene_triangle_count * sizeof(Triangle);
+        auto instances_size =
+            top_bvh.node_count * sizeof(Bvh::Node) +
+            instance_count * (sizeof(size_t) + sizeof(Instance));
+        Log("Two-level BVH : {} instance(s), {:.2f} MB for the scene and {:.2f} MB for the instances, instead of {:.2f} MB if flattened",
+            instance_count, mesh_size / (1024.0 * 1024.0), instances_size / (1024.0 * 1024.0),
+            instance_count * mesh_size / (1024.0 * 1024.0));
+    }
 
     auto pixels = std::make_unique<Scalar[]>(3 * width * height);
 
-    std::cout << "Rendering image (" << width << "x" << height << ")..." << std::endl;
-    profile("Rendering", [&] {
-        if (permute) {
-            if (collect_statistics)
-                render<true, true>(camera, bvh, shuffled_triangles.get(), pixels.get(), width, height, statistics_weights);
-            else
-                render<true, false>(camera, bvh, shuffled_triangles.get(), pixels.get(), width, height);
-        } else {
-            if (collect_statistics)
-                render<false, true>(camera, bvh, triangles.data(), pixels.get(), width, height, statistics_weights);
-            else
-                render<false, false>(camera, bvh, triangles.data(), pixels.get(), width, height);
+    std::cout << "Rendering image (" << width << "x" << height << ", " << traverser_name;
+    if (instance_count > 0)
+        std::cout << ", " << instance_count << " instance(s)";
+    std::cout << ")..." << std::endl;
+    RenderReport report;
+    auto rendering_time = profile("Rendering", [&] {
+        if (instance_count > 0)
+        {
+            report = render_instances(
+                top_bvh, instances.data(), scene.permuted, collect_statistics, camera,
+                pixels.get(), width, height, tile_size, statistics_weights);
+        }
+        else
+        {
+            report = render_image(
+                *traverser_type, collect_statistics, camera, scene,
+                pixels.get(), width, height, tile_size, statistics_weights);
         }
     });
+    report_rendering(report);
+    Log("{:.2f} Mrays/s", Scalar(width * height) / (rendering_time * Scalar(1000)));
 
     std::ofstream out(output_file, std::ofstream::binary);
     out << "P6 " << width << " " << height << " " << 255 << "\n";
@@ -555,7 +1930,12 @@ int EntryPointMain(int argc, char** argv)
     return 0;
 }
 
-
+#ifdef BVH_HEADLESS_BENCH
+int main(int argc, char** argv)
+{
+    return EntryPointMain(argc, argv);
+}
+#else
 void Rendering(void *userData)
 {
     static bool done = false;
@@ -581,6 +1961,7 @@ void Rendering(void *userData)
     bool permute = false;
     bool optimize_layout = false;
     bool parallel_reinsertion = false;
+    bool treelet_restructuring = false;
     bool collapse_leaves = false;
     size_t build_iterations = 1;
     Scalar pre_split_factor = 0;
@@ -602,7 +1983,7 @@ void Rendering(void *userData)
     Scalar *pixels = new Scalar[(3 * width * height)];
     settings.data = pixels;
 
-    std::function<size_t(Bvh&, const Triangle*, const BoundingBox&, const BoundingBox*, const Vector3*, size_t)> builder;
+    BuilderFunction builder;
     if (!strcmp(builder_name, "binned_sah"))
     {
         builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
@@ -656,6 +2037,39 @@ void Rendering(void *userData)
             return primitive_count;
         };
     }
+    else if (!strcmp(builder_name, "hlbvh"))
+    {
+        builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        {
+            PROFILER_MARKER(hlbvh_build);
+            using Morton = uint32_t;
+            bvh::HierarchicalLinearBvhBuilder<Bvh, Morton> builder(bvh);
+            builder.build(global_bbox, bboxes, centers, primitive_count);
+            return primitive_count;
+        };
+    }
+    else if (!strcmp(builder_name, "aac"))
+    {
+        builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        {
+            PROFILER_MARKER(aac_build);
+            using Morton = uint32_t;
+            bvh::ApproximateAgglomerativeClusteringBuilder<Bvh, Morton> builder(bvh);
+            builder.build(global_bbox, bboxes, centers, primitive_count);
+            return primitive_count;
+        };
+    }
+    else if (!strcmp(builder_name, "radix_tree"))
+    {
+        builder = [] (Bvh& bvh, const Triangle*, const BoundingBox& global_bbox, const BoundingBox* bboxes, const Vector3* centers, size_t primitive_count)
+        {
+            PROFILER_MARKER(radix_tree_build);
+            using Morton = uint32_t;
+            bvh::RadixTreeBvhBuilder<Bvh, Morton> builder(bvh);
+            builder.build(global_bbox, bboxes, centers, primitive_count);
+            return primitive_count;
+        };
+    }
     else
     {
         Err("Unknown BVH builder name");
@@ -674,12 +2088,8 @@ void Rendering(void *userData)
     }
 
     // Rotate triangles if requested
-    if (rotation_axis == 0)
-        rotate_triangles<0>(rotation_degrees, triangles.data(), triangles.size());
-    else if (rotation_axis == 1)
-        rotate_triangles<1>(rotation_degrees, triangles.data(), triangles.size());
-    else if (rotation_axis == 2)
-        rotate_triangles<2>(rotation_degrees, triangles.data(), triangles.size());
+    if (rotation_axis < 3)
+        transform_triangles(axis_rotation(rotation_axis, rotation_degrees), triangles.data(), triangles.size());
 
     Bvh bvh;
 
@@ -690,6 +2100,8 @@ void Rendering(void *userData)
     ss << "Building BVH (" << builder_name;
     if (pre_split_factor)
         ss << " + pre-split";
+    if (treelet_restructuring)
+        ss << " + treelet-restructuring";
     if (parallel_reinsertion)
         ss << " + parallel-reinsertion";
     if (optimize_layout)
@@ -714,6 +2126,11 @@ void Rendering(void *userData)
         reference_count = builder(bvh, triangles.data(), global_bbox, bboxes.get(), centers.get(), reference_count);
         if (pre_split_factor > 0)
             splitter.repair_bvh_leaves(bvh);
+        if (treelet_restructuring)
+        {
+            bvh::TreeletRestructuringOptimizer<Bvh> restructuring_optimizer(bvh);
+            restructuring_optimizer.optimize();
+        }
         if (parallel_reinsertion)
         {
             bvh::ParallelReinsertionOptimizer<Bvh> reinsertion_optimizer(bvh);
@@ -743,25 +2160,22 @@ void Rendering(void *userData)
 
     Log("Rendering image ({}x{})", width, height);
 
+    RenderScene scene;
+    scene.bvh = &bvh;
+    scene.triangles = permute ? shuffled_triangles.get() : triangles.data();
+    scene.permuted = permute;
+
+    RenderReport report;
     profile("Rendering", [&] {
         PROFILER_MARKER(rendering);
-        if (permute)
-        {
-            if (collect_statistics)
-                render<true, true>(camera, bvh, shuffled_triangles.get(), pixels, width, height, statistics_weights);
-            else
-                render<true, false>(camera, bvh, shuffled_triangles.get(), pixels, width, height);
-        }
-        else
-        {
-            if (collect_statistics)
-                render<false, true>(camera, bvh, triangles.data(), pixels, width, height, statistics_weights);
-            else
-                render<false, false>(camera, bvh, triangles.data(), pixels, width, height);
-        }
+        report = render_image(
+            TraverserType::Single, collect_statistics, camera, scene,
+            pixels, width, height, default_tile_size, statistics_weights);
     });
+    report_rendering(report);
 
     done = true;
     //return pixels.get();
     return ;
 }
+#endif
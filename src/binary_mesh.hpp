@@ -0,0 +1,195 @@
+#ifndef BINARY_MESH_HPP
+#define BINARY_MESH_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+
+#include "mapped_file.h"
+
+// Compact binary mesh format, written by the `obj2bin` tool. A file contains a header, followed
+// by the vertices of the mesh, three 32-bit vertex indices per triangle, and optionally the
+// triangles themselves, precomputed in the layout of `Triangle`. Each array is aligned, so that
+// the file can be mapped into memory and its triangles used in place, without any parsing.
+namespace binary_mesh {
+
+static constexpr char     magic[8]  = { 'B', 'V', 'H', 'M', 'E', 'S', 'H', '\0' };
+static constexpr uint32_t version   = 1;
+static constexpr size_t   alignment = 64;
+
+struct Header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t vertex_size;
+    // Zero when the file has no triangle array
+    uint32_t triangle_size;
+    uint32_t padding;
+    uint64_t vertex_count;
+    uint64_t triangle_count;
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    uint64_t triangle_offset;
+};
+
+// Returns true if the given file contents start like a binary mesh.
+inline bool has_magic(const void* data, size_t size) {
+    return size >= sizeof(magic) && !std::memcmp(data, magic, sizeof(magic));
+}
+
+// Reads and validates the header of the given file contents.
+inline bool read_header(const uint8_t* data, size_t size, Header& header) {
+    if (size < sizeof(Header))
+        return false;
+    std::memcpy(&header, data, sizeof(Header));
+    auto fits = [&] (uint64_t offset, uint64_t count, uint64_t element_size) {
+        return offset % alignment == 0 && offset <= size && count <= (size - offset) / element_size;
+    };
+    return
+        has_magic(data, size) &&
+        header.version     == version &&
+        header.vertex_size == sizeof(Vector3) &&
+        (header.triangle_size == 0 || header.triangle_size == sizeof(Triangle)) &&
+        fits(header.vertex_offset, header.vertex_count, sizeof(Vector3)) &&
+        fits(header.index_offset, header.triangle_count, 3 * sizeof(uint32_t)) &&
+        (header.triangle_size == 0 || fits(header.triangle_offset, header.triangle_count, sizeof(Triangle)));
+}
+
+// Builds triangles from vertices and three vertex indices per triangle.
+// Returns false if an index refers to a vertex that does not exist.
+inline bool make_triangles(
+    const Vector3* vertices, size_t vertex_count,
+    const uint32_t* indices, size_t triangle_count,
+    Triangle* triangles)
+{
+    bool valid = true;
+    #pragma omp parallel for reduction(&&: valid)
+    for (size_t i = 0; i < triangle_count; ++i) {
+        auto a = indices[3 * i + 0], b = indices[3 * i + 1], c = indices[3 * i + 2];
+        if (a < vertex_count && b < vertex_count && c < vertex_count)
+            triangles[i] = Triangle(vertices[a], vertices[b], vertices[c]);
+        else
+            valid = false;
+    }
+    return valid;
+}
+
+// Triangles of a binary mesh file, mapped into memory. When the file has a triangle array, the
+// triangles point into the mapping, which is copy-on-write: they can be modified in place, but
+// the changes are never written back to the file. Otherwise, they are built from the indices.
+class MappedMesh
+{
+public:
+    Triangle* triangles = nullptr;
+    size_t triangle_count = 0;
+
+    explicit MappedMesh(const std::string& path)
+        : file(path)
+    {}
+
+private:
+    MappedFile file;
+    std::vector<Triangle> built_triangles;
+
+    friend std::unique_ptr<MappedMesh> load(const std::string&);
+};
+
+// Maps the given file, and returns null if it is not a valid binary mesh.
+inline std::unique_ptr<MappedMesh> load(const std::string& path) {
+    auto mesh = std::make_unique<MappedMesh>(path);
+    auto data = mesh->file.Data();
+    Header header;
+    if (!mesh->file.IsOpen() || !read_header(data, mesh->file.Size(), header))
+        return nullptr;
+
+    if (header.triangle_size != 0) {
+        mesh->triangles = reinterpret_cast<Triangle*>(data + header.triangle_offset);
+    } else {
+        mesh->built_triangles.resize(header.triangle_count);
+        if (!make_triangles(
+            reinterpret_cast<const Vector3*>(data + header.vertex_offset), header.vertex_count,
+            reinterpret_cast<const uint32_t*>(data + header.index_offset), header.triangle_count,
+            mesh->built_triangles.data()))
+            return nullptr;
+        mesh->triangles = mesh->built_triangles.data();
+    }
+    mesh->triangle_count = header.triangle_count;
+    return mesh;
+}
+
+// Returns a copy of the triangles of the given binary mesh file contents,
+// or an empty vector if they are not a valid binary mesh.
+inline std::vector<Triangle> load_from_memory(const uint8_t* data, size_t size) {
+    Header header;
+    if (!read_header(data, size, header))
+        return std::vector<Triangle>();
+
+    std::vector<Triangle> triangles(header.triangle_count);
+    if (header.triangle_size != 0) {
+        std::memcpy(triangles.data(), data + header.triangle_offset, header.triangle_count * sizeof(Triangle));
+    } else if (!make_triangles(
+        reinterpret_cast<const Vector3*>(data + header.vertex_offset), header.vertex_count,
+        reinterpret_cast<const uint32_t*>(data + header.index_offset), header.triangle_count,
+        triangles.data())) {
+        return std::vector<Triangle>();
+    }
+    return triangles;
+}
+
+// Writes a binary mesh file, with or without the precomputed triangle array.
+// The file is written under a temporary name first. Returns false on failure.
+inline bool save(
+    const std::string& path,
+    const Vector3* vertices, size_t vertex_count,
+    const uint32_t* indices, size_t triangle_count,
+    bool with_triangles)
+{
+    auto align = [] (uint64_t offset) { return (offset + alignment - 1) / alignment * alignment; };
+
+    Header header = {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version         = version;
+    header.vertex_size     = sizeof(Vector3);
+    header.triangle_size   = with_triangles ? sizeof(Triangle) : 0;
+    header.vertex_count    = vertex_count;
+    header.triangle_count  = triangle_count;
+    header.vertex_offset   = align(sizeof(Header));
+    header.index_offset    = align(header.vertex_offset + vertex_count * sizeof(Vector3));
+    header.triangle_offset = with_triangles ? align(header.index_offset + triangle_count * 3 * sizeof(uint32_t)) : 0;
+
+    std::vector<Triangle> triangles(with_triangles ? triangle_count : 0);
+    if (with_triangles && !make_triangles(vertices, vertex_count, indices, triangle_count, triangles.data()))
+        return false;
+
+    std::error_code error;
+    auto temporary_path = path + ".tmp";
+    {
+        std::ofstream out(temporary_path, std::ofstream::binary);
+        auto write_at = [&] (uint64_t offset, const void* data, size_t size) {
+            static const char padding[alignment] = {};
+            out.write(padding, std::streamsize(offset - uint64_t(out.tellp())));
+            out.write(static_cast<const char*>(data), std::streamsize(size));
+        };
+        write_at(0, &header, sizeof(Header));
+        write_at(header.vertex_offset, vertices, vertex_count * sizeof(Vector3));
+        write_at(header.index_offset, indices, triangle_count * 3 * sizeof(uint32_t));
+        if (with_triangles)
+            write_at(header.triangle_offset, triangles.data(), triangle_count * sizeof(Triangle));
+        if (!out)
+            return false;
+    }
+    std::filesystem::rename(temporary_path, path, error);
+    if (error) {
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
+
+} // namespace binary_mesh
+
+#endif
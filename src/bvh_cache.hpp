@@ -0,0 +1,215 @@
+#ifndef BVH_CACHE_HPP
+#define BVH_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+
+#include "mapped_file.h"
+
+// Cache of built BVHs. Every cache file contains a header, followed by the nodes of the BVH,
+// its primitive indices, and the triangles it refers to (in BVH order if it was built with
+// primitive permutation). Each array starts on a page boundary, so that the file can be mapped
+// into memory and traversed in place, without parsing the mesh, building, or even copying the BVH.
+// Files are named after a hash of the contents of the source mesh and of the build options.
+namespace bvh_cache {
+
+static constexpr char     magic[8]  = { 'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E' };
+static constexpr uint32_t version   = 1;
+static constexpr size_t   page_size = 4096;
+
+struct Header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint32_t triangle_size;
+    uint32_t permuted;
+    uint64_t mesh_hash;
+    uint64_t options_hash;
+    uint64_t node_count;
+    uint64_t reference_count;
+    uint64_t triangle_count;
+    uint64_t node_offset;
+    uint64_t primitive_index_offset;
+    uint64_t triangle_offset;
+    // Build options, for inspection only (possibly truncated)
+    char     build_options[192];
+};
+
+inline uint64_t rotate_left(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+// Hashes the given bytes, 8 at a time (this is the bulk loop and finalizer of MurmurHash3).
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0) {
+    static constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+    static constexpr uint64_t c2 = 0x4cf5ad432745937full;
+    auto bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash ^= rotate_left(word * c1, 31) * c2;
+        hash = rotate_left(hash, 27) * 5 + 0x52dce729;
+    }
+    uint64_t tail = 0;
+    for (size_t j = 0; i + j < size; ++j)
+        tail |= uint64_t(bytes[i + j]) << (8 * j);
+    hash ^= rotate_left(tail * c1, 31) * c2;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+inline uint64_t hash_options(const std::string& build_options) {
+    return hash_bytes(build_options.data(), build_options.size());
+}
+
+// Hashes the contents of the given file. Returns false if it cannot be read.
+inline bool hash_file(const std::string& path, uint64_t& hash) {
+    MappedFile file(path);
+    if (!file.IsOpen())
+        return false;
+    hash = hash_bytes(file.Data(), file.Size());
+    return true;
+}
+
+inline std::string file_name(const std::string& directory, uint64_t mesh_hash, const std::string& build_options) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "%016llx-%016llx.bvh",
+        static_cast<unsigned long long>(mesh_hash),
+        static_cast<unsigned long long>(hash_options(build_options)));
+    return (std::filesystem::path(directory) / name).string();
+}
+
+// BVH and triangles of a cache file, mapped into memory. The arrays of the BVH point into the
+// mapping, which is copy-on-write: the BVH can be traversed, or modified in place, but its arrays
+// must not be replaced or reallocated (e.g. by a builder or by `bvh::DynamicBvhUpdater`).
+class MappedBvh
+{
+public:
+    Bvh bvh;
+    const Triangle* triangles = nullptr;
+    size_t triangle_count  = 0;
+    size_t reference_count = 0;
+    bool permuted = false;
+
+    explicit MappedBvh(const std::string& path)
+        : file(path)
+    {}
+
+    ~MappedBvh() {
+        // The arrays belong to the mapping
+        bvh.nodes.release();
+        bvh.primitive_indices.release();
+    }
+
+private:
+    MappedFile file;
+
+    friend std::unique_ptr<MappedBvh> load(const std::string&, uint64_t, const std::string&);
+};
+
+// Maps the given cache file, and returns null if it does not exist, or if it does not match
+// the given mesh and build options, or this version of the format.
+inline std::unique_ptr<MappedBvh> load(const std::string& path, uint64_t mesh_hash, const std::string& build_options) {
+    auto mapped_bvh = std::make_unique<MappedBvh>(path);
+    auto& file = mapped_bvh->file;
+    if (!file.IsOpen() || file.Size() < sizeof(Header))
+        return nullptr;
+
+    Header header;
+    std::memcpy(&header, file.Data(), sizeof(Header));
+    auto fits = [&] (uint64_t offset, uint64_t count, uint64_t size) {
+        return offset % page_size == 0 && offset <= file.Size() && count <= (file.Size() - offset) / size;
+    };
+    if (std::memcmp(header.magic, magic, sizeof(magic)) ||
+        header.version       != version ||
+        header.node_size     != sizeof(Bvh::Node) ||
+        header.triangle_size != sizeof(Triangle) ||
+        header.mesh_hash     != mesh_hash ||
+        header.options_hash  != hash_options(build_options) ||
+        header.node_count == 0 ||
+        !fits(header.node_offset,            header.node_count,      sizeof(Bvh::Node)) ||
+        !fits(header.primitive_index_offset, header.reference_count, sizeof(size_t)) ||
+        !fits(header.triangle_offset,        header.triangle_count,  sizeof(Triangle)))
+        return nullptr;
+
+    auto& bvh = mapped_bvh->bvh;
+    bvh.nodes.reset(reinterpret_cast<Bvh::Node*>(file.Data() + header.node_offset));
+    bvh.primitive_indices.reset(reinterpret_cast<size_t*>(file.Data() + header.primitive_index_offset));
+    bvh.node_count = header.node_count;
+    mapped_bvh->triangles       = reinterpret_cast<const Triangle*>(file.Data() + header.triangle_offset);
+    mapped_bvh->triangle_count  = header.triangle_count;
+    mapped_bvh->reference_count = header.reference_count;
+    mapped_bvh->permuted        = header.permuted != 0;
+    return mapped_bvh;
+}
+
+// Writes the given BVH and triangles to a cache file. The file is written under a temporary
+// name first, so that a partially written file is never loaded. Returns false on failure.
+inline bool save(
+    const std::string& path,
+    const Bvh& bvh,
+    size_t reference_count,
+    const Triangle* triangles,
+    size_t triangle_count,
+    bool permuted,
+    uint64_t mesh_hash,
+    const std::string& build_options)
+{
+    auto align = [] (uint64_t offset) { return (offset + page_size - 1) / page_size * page_size; };
+
+    Header header = {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version         = version;
+    header.node_size       = sizeof(Bvh::Node);
+    header.triangle_size   = sizeof(Triangle);
+    header.permuted        = permuted;
+    header.mesh_hash       = mesh_hash;
+    header.options_hash    = hash_options(build_options);
+    header.node_count      = bvh.node_count;
+    header.reference_count = reference_count;
+    header.triangle_count  = triangle_count;
+    header.node_offset            = align(sizeof(Header));
+    header.primitive_index_offset = align(header.node_offset + bvh.node_count * sizeof(Bvh::Node));
+    header.triangle_offset        = align(header.primitive_index_offset + reference_count * sizeof(size_t));
+    std::strncpy(header.build_options, build_options.c_str(), sizeof(header.build_options) - 1);
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    auto temporary_path = path + ".tmp";
+    {
+        std::ofstream out(temporary_path, std::ofstream::binary);
+        auto write_at = [&] (uint64_t offset, const void* data, size_t size) {
+            static const char padding[page_size] = {};
+            out.write(padding, std::streamsize(offset - uint64_t(out.tellp())));
+            out.write(static_cast<const char*>(data), std::streamsize(size));
+        };
+        write_at(0, &header, sizeof(Header));
+        write_at(header.node_offset, bvh.nodes.get(), bvh.node_count * sizeof(Bvh::Node));
+        write_at(header.primitive_index_offset, bvh.primitive_indices.get(), reference_count * sizeof(size_t));
+        write_at(header.triangle_offset, triangles, triangle_count * sizeof(Triangle));
+        if (!out)
+            return false;
+    }
+    std::filesystem::rename(temporary_path, path, error);
+    if (error) {
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
+
+} // namespace bvh_cache
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _mapped_file_h
+#define _mapped_file_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Maps a whole file into memory. The mapping is private and copy-on-write: its contents
+// can be modified in place, but the changes are never written back to the file.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+            return;
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (!mapping_)
+            return;
+        data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_COPY, 0, 0, 0));
+        if (data_)
+            size_ = size_t(size.QuadPart);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void* data = mmap(NULL, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                data_ = static_cast<uint8_t*>(data);
+                size_ = size_t(info.st_size);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+#else
+        if (data_)
+            munmap(data_, size_);
+#endif
+    }
+
+    // Returns false if the file does not exist, is empty, or cannot be mapped.
+    bool IsOpen() const { return data_ != nullptr; }
+
+    uint8_t* Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#endif
+};
+
+#endif
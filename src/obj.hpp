@@ -3,115 +3,193 @@
 
 #include <vector>
 #include <string>
-#include <optional>
-#include <fstream>
-#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <charconv>
+#include <iterator>
+#include <istream>
+
+#include "mapped_file.h"
+#include "binary_mesh.hpp"
 
 namespace obj {
 
-inline void remove_eol(char* ptr) {
-    int i = 0;
-    while (ptr[i]) i++;
-    i--;
-    while (i > 0 && std::isspace(ptr[i])) {
-        ptr[i] = '\0';
-        i--;
-    }
+// Files are parsed in chunks of roughly this size, in parallel
+static constexpr size_t chunk_size = 256 * 1024;
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
 }
 
-inline char* strip_spaces(char* ptr) {
-    while (std::isspace(*ptr)) ptr++;
+inline const char* skip_blanks(const char* ptr, const char* end) {
+    while (ptr < end && is_blank(*ptr)) ptr++;
     return ptr;
 }
 
-inline std::optional<int> read_index(char** ptr) {
-    char* base = *ptr;
-
-    // Detect end of line (negative indices are supported) 
-    base = strip_spaces(base);
-    if (!std::isdigit(*base) && *base != '-')
-        return std::nullopt;
-
-    int index = std::strtol(base, &base, 10);
-    base = strip_spaces(base);
-
-    if (*base == '/') {
-        base++;
-
-        // Handle the case when there is no texture coordinate
-        if (*base != '/')
-            std::strtol(base, &base, 10);
-
-        base = strip_spaces(base);
+inline const char* read_float(const char* ptr, const char* end, float& value) {
+    ptr = skip_blanks(ptr, end);
+    // std::from_chars does not accept an explicit plus sign
+    if (ptr < end && *ptr == '+')
+        ptr++;
+    return std::from_chars(ptr, end, value).ptr;
+}
 
-        if (*base == '/') {
-            base++;
-            std::strtol(base, &base, 10);
+// Vertices of a mesh, and three vertex indices per triangle
+struct Mesh {
+    std::vector<Vector3> vertices;
+    std::vector<uint32_t> indices;
+};
+
+// Vertices and faces of a chunk of the file. Face indices are stored as they appear in the
+// file, since relative (negative) indices can only be resolved once the number of vertices
+// in the previous chunks is known: the lowest bit of every corner tells whether it is
+// relative, in which case the rest is an index into the vertices of the chunk (possibly
+// negative, when it refers to a vertex of a previous chunk).
+struct Chunk {
+    std::vector<Vector3> vertices;
+    std::vector<int64_t> corners;
+    size_t vertex_offset   = 0;
+    size_t triangle_offset = 0;
+    size_t triangle_count  = 0;
+};
+
+inline void parse_chunk(const char* ptr, const char* end, Chunk& chunk) {
+    while (ptr < end) {
+        auto line_end = static_cast<const char*>(std::memchr(ptr, '\n', end - ptr));
+        if (!line_end)
+            line_end = end;
+        ptr = skip_blanks(ptr, line_end);
+        if (line_end - ptr >= 2 && is_blank(ptr[1])) {
+            if (*ptr == 'v') {
+                float x = 0, y = 0, z = 0;
+                ptr = read_float(ptr + 1, line_end, x);
+                ptr = read_float(ptr, line_end, y);
+                ptr = read_float(ptr, line_end, z);
+                chunk.vertices.emplace_back(x, y, z);
+            } else if (*ptr == 'f') {
+                // Polygons are split into fans of triangles
+                int64_t first = 0, last = 0;
+                ptr += 2;
+                for (size_t i = 0; ; ++i) {
+                    ptr = skip_blanks(ptr, line_end);
+                    int64_t index = 0;
+                    auto [next, error] = std::from_chars(ptr, line_end, index);
+                    if (error != std::errc() || index == 0)
+                        break;
+                    // Texture coordinate and normal indices are ignored
+                    ptr = next;
+                    while (ptr < line_end && !is_blank(*ptr)) ptr++;
+
+                    int64_t corner = index < 0
+                        ? ((int64_t(chunk.vertices.size()) + index) * 2) | 1
+                        : (index - 1) * 2;
+                    if (i >= 2) {
+                        chunk.corners.push_back(first);
+                        chunk.corners.push_back(last);
+                        chunk.corners.push_back(corner);
+                        chunk.triangle_count++;
+                    } else if (i == 0) {
+                        first = corner;
+                    }
+                    last = corner;
+                }
+            }
         }
+        ptr = line_end + 1;
     }
-
-    *ptr = base;
-    return std::make_optional(index);
 }
 
-inline std::vector<Triangle> load_from_stream(std::istream& is)
+// Parses the given OBJ file contents. The data is split into chunks at line boundaries, which
+// are parsed in parallel; a second parallel pass then resolves the face indices.
+// Returns false if a face refers to a vertex that does not exist, or if the mesh
+// has more vertices than 32-bit indices can refer to.
+inline bool load_mesh_from_memory(const char* data, size_t size, Mesh& mesh)
 {
-    static constexpr size_t max_line = 1024;
-    char line[max_line];
-
-    std::vector<Vector3> vertices;
-    std::vector<Triangle> triangles;
-
-    while (is.getline(line, max_line))
-    {
-        char* ptr = strip_spaces(line);
-        if (*ptr == '\0' || *ptr == '#')
-            continue;
-        remove_eol(ptr);
-        if (*ptr == 'v' && std::isspace(ptr[1]))
-        {
-            auto x = std::strtof(ptr + 1, &ptr);
-            auto y = std::strtof(ptr, &ptr);
-            auto z = std::strtof(ptr, &ptr);
-            vertices.emplace_back(x, y, z);
-        }
-        else if (*ptr == 'f' && std::isspace(ptr[1]))
-        {
-            Vector3 points[2];
-            ptr += 2;
-            for (size_t i = 0; ; ++i)
-            {
-                if (auto index = read_index(&ptr))
-                {
-                    size_t j = *index < 0 ? vertices.size() + *index : *index - 1;
-                    assert(j < vertices.size());
-                    auto v = vertices[j];
-                    if (i >= 2)
-                    {
-                        triangles.emplace_back(points[0], points[1], v);
-                        points[1] = v;
-                    }
-                    else
-                    {
-                        points[i] = v;
-                    }
-                }
-                else
-                {
-                    break;
-                }
+    std::vector<const char*> bounds(1, data);
+    for (size_t offset = chunk_size; offset < size; ) {
+        auto line_end = static_cast<const char*>(std::memchr(data + offset, '\n', size - offset));
+        if (!line_end)
+            break;
+        bounds.push_back(line_end + 1);
+        offset = line_end + 1 - data + chunk_size;
+    }
+    bounds.push_back(data + size);
+
+    std::vector<Chunk> chunks(bounds.size() - 1);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < chunks.size(); ++i)
+        parse_chunk(bounds[i], bounds[i + 1], chunks[i]);
+
+    size_t vertex_count = 0, triangle_count = 0;
+    for (auto& chunk : chunks) {
+        chunk.vertex_offset   = vertex_count;
+        chunk.triangle_offset = triangle_count;
+        vertex_count   += chunk.vertices.size();
+        triangle_count += chunk.triangle_count;
+    }
+    if (vertex_count > std::numeric_limits<uint32_t>::max())
+        return false;
+
+    mesh.vertices.resize(vertex_count);
+    mesh.indices.resize(3 * triangle_count);
+    bool valid = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&: valid)
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        auto& chunk = chunks[i];
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(), mesh.vertices.begin() + chunk.vertex_offset);
+        for (size_t j = 0; j < 3 * chunk.triangle_count; ++j) {
+            auto corner = chunk.corners[j];
+            int64_t index = (corner >> 1) + ((corner & 1) ? int64_t(chunk.vertex_offset) : 0);
+            if (index < 0 || uint64_t(index) >= vertex_count) {
+                valid = false;
+                break;
             }
+            mesh.indices[3 * chunk.triangle_offset + j] = uint32_t(index);
         }
     }
+    return valid;
+}
 
+// Returns the triangles of the given file contents, which are either in the OBJ format,
+// or in the binary format of `binary_mesh` (the format is detected automatically).
+// Returns an empty vector if they cannot be parsed.
+inline std::vector<Triangle> load_from_memory(const char* data, size_t size)
+{
+    if (binary_mesh::has_magic(data, size))
+        return binary_mesh::load_from_memory(reinterpret_cast<const uint8_t*>(data), size);
+
+    Mesh mesh;
+    if (!load_mesh_from_memory(data, size, mesh))
+        return std::vector<Triangle>();
+    std::vector<Triangle> triangles(mesh.indices.size() / 3);
+    binary_mesh::make_triangles(
+        mesh.vertices.data(), mesh.vertices.size(),
+        mesh.indices.data(), triangles.size(),
+        triangles.data());
     return triangles;
 }
 
+inline std::vector<Triangle> load_from_stream(std::istream& is)
+{
+    std::string contents(std::istreambuf_iterator<char>(is), {});
+    return load_from_memory(contents.data(), contents.size());
+}
+
+inline bool load_mesh_from_file(const std::string& file, Mesh& mesh)
+{
+    MappedFile mapped_file(file);
+    return
+        mapped_file.IsOpen() &&
+        load_mesh_from_memory(reinterpret_cast<const char*>(mapped_file.Data()), mapped_file.Size(), mesh);
+}
+
 inline std::vector<Triangle> load_from_file(const std::string& file)
 {
-    std::ifstream is(file);
-    if (is)
-        return load_from_stream(is);
+    MappedFile mapped_file(file);
+    if (mapped_file.IsOpen())
+        return load_from_memory(reinterpret_cast<const char*>(mapped_file.Data()), mapped_file.Size());
     return std::vector<Triangle>();
 }
 
@@ -0,0 +1,133 @@
+#ifndef _tile_scheduler_h
+#define _tile_scheduler_h
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include <bvh/platform.hpp>
+
+#include "Log.h"
+
+// Splits an image into square tiles, which are handed out dynamically to the threads.
+// The time spent on every tile, and the time every thread spends rendering tiles,
+// are recorded so that load imbalance can be reported with `Report()`.
+class TileScheduler
+{
+public:
+    struct Tile
+    {
+        size_t x_begin, y_begin;
+        size_t x_end, y_end;
+    };
+
+    TileScheduler(size_t width, size_t height, size_t tile_size)
+        : width_(width)
+        , height_(height)
+        , tile_size_(std::max(tile_size, size_t(1)))
+    {
+        tiles_x_ = (width_  + tile_size_ - 1) / tile_size_;
+        tiles_y_ = (height_ + tile_size_ - 1) / tile_size_;
+        tile_times_.resize(tiles_x_ * tiles_y_, 0);
+    }
+
+    size_t TileCount() const { return tile_times_.size(); }
+
+    // Calls `f(tile)` for every tile, in parallel.
+    template <typename F>
+    void Run(F&& f)
+    {
+        using namespace std::chrono;
+
+        size_t tile_count = TileCount();
+        thread_times_.clear();
+
+        #pragma omp parallel
+        {
+            #pragma omp single
+            thread_times_.resize(bvh::get_thread_count(), 0);
+
+            double thread_time = 0;
+            #pragma omp for schedule(dynamic)
+            for (size_t i = 0; i < tile_count; ++i)
+            {
+                auto start_tick = high_resolution_clock::now();
+                f(GetTile(i));
+                auto end_tick = high_resolution_clock::now();
+                tile_times_[i] = duration<double, std::milli>(end_tick - start_tick).count();
+                thread_time += tile_times_[i];
+            }
+            thread_times_[bvh::get_thread_id()] = thread_time;
+        }
+    }
+
+    // Calls `f(x, y)` for every pixel of the tile, in Morton (Z-curve) order.
+    template <typename F>
+    static void ForEachPixel(const Tile& tile, F&& f)
+    {
+        size_t size = std::max(tile.x_end - tile.x_begin, tile.y_end - tile.y_begin);
+        size_t pow2 = 1;
+        while (pow2 < size)
+            pow2 <<= 1;
+        // Pixels of the enclosing power-of-two square that fall outside of the tile are skipped
+        for (size_t code = 0; code < pow2 * pow2; ++code)
+        {
+            size_t x = tile.x_begin + CompactBits(code);
+            size_t y = tile.y_begin + CompactBits(code >> 1);
+            if (x < tile.x_end && y < tile.y_end)
+                f(x, y);
+        }
+    }
+
+    // Logs the distribution of the tile and thread times of the last call to `Run()`.
+    void Report() const
+    {
+        if (tile_times_.empty())
+            return;
+
+        auto [min_tile, max_tile] = std::minmax_element(tile_times_.begin(), tile_times_.end());
+        double total = 0;
+        for (auto time : tile_times_)
+            total += time;
+        double average = total / tile_times_.size();
+        auto tile = GetTile(max_tile - tile_times_.begin());
+        Log("{} tile(s) of {}x{} pixels: min {:.3f} ms, average {:.3f} ms, max {:.3f} ms (max/average {:.2f}), slowest tile at ({}, {})",
+            tile_times_.size(), tile_size_, tile_size_,
+            *min_tile, average, *max_tile, average > 0 ? *max_tile / average : 0.0,
+            tile.x_begin, tile.y_begin);
+
+        if (!thread_times_.empty())
+        {
+            auto [min_thread, max_thread] = std::minmax_element(thread_times_.begin(), thread_times_.end());
+            Log("{} thread(s): busy time min {:.3f} ms, max {:.3f} ms", thread_times_.size(), *min_thread, *max_thread);
+        }
+    }
+
+private:
+    Tile GetTile(size_t index) const
+    {
+        size_t x = (index % tiles_x_) * tile_size_;
+        size_t y = (index / tiles_x_) * tile_size_;
+        return Tile { x, y, std::min(x + tile_size_, width_), std::min(y + tile_size_, height_) };
+    }
+
+    // Keeps the even bits of the given integer, and packs them together.
+    static size_t CompactBits(size_t code)
+    {
+        size_t result = 0;
+        for (size_t bit = 0; (code >> (2 * bit)) != 0; ++bit)
+            result |= ((code >> (2 * bit)) & 1) << bit;
+        return result;
+    }
+
+    size_t width_;
+    size_t height_;
+    size_t tile_size_;
+    size_t tiles_x_;
+    size_t tiles_y_;
+    std::vector<double> tile_times_;
+    std::vector<double> thread_times_;
+};
+
+#endif
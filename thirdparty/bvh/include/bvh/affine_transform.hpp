@@ -0,0 +1,146 @@
+#ifndef BVH_AFFINE_TRANSFORM_HPP
+#define BVH_AFFINE_TRANSFORM_HPP
+
+#include <cmath>
+
+#include "bvh/vector.hpp"
+#include "bvh/bounding_box.hpp"
+#include "bvh/ray.hpp"
+
+namespace bvh {
+
+/// Affine transformation, stored as the three first rows of a 4x4 matrix
+/// (a 3x3 linear part followed by a translation on every row).
+template <typename Scalar>
+struct AffineTransform {
+    Scalar matrix[3][4];
+
+    AffineTransform() = default;
+
+    static AffineTransform identity() {
+        return scaling(Vector3<Scalar>(1));
+    }
+
+    static AffineTransform translation(const Vector3<Scalar>& t) {
+        auto transform = identity();
+        for (int i = 0; i < 3; ++i)
+            transform.matrix[i][3] = t[i];
+        return transform;
+    }
+
+    static AffineTransform scaling(const Vector3<Scalar>& s) {
+        AffineTransform transform;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 4; ++j)
+                transform.matrix[i][j] = i == j ? s[i] : Scalar(0);
+        }
+        return transform;
+    }
+
+    /// Rotation of the given angle, in radians, around the given axis (which must be normalized).
+    static AffineTransform rotation(const Vector3<Scalar>& axis, Scalar angle) {
+        auto c = std::cos(angle);
+        auto s = std::sin(angle);
+        auto d = Scalar(1) - c;
+        auto x = axis[0], y = axis[1], z = axis[2];
+        AffineTransform transform;
+        transform.matrix[0][0] = x * x * d + c;
+        transform.matrix[0][1] = x * y * d - z * s;
+        transform.matrix[0][2] = x * z * d + y * s;
+        transform.matrix[1][0] = y * x * d + z * s;
+        transform.matrix[1][1] = y * y * d + c;
+        transform.matrix[1][2] = y * z * d - x * s;
+        transform.matrix[2][0] = z * x * d - y * s;
+        transform.matrix[2][1] = z * y * d + x * s;
+        transform.matrix[2][2] = z * z * d + c;
+        for (int i = 0; i < 3; ++i)
+            transform.matrix[i][3] = Scalar(0);
+        return transform;
+    }
+
+    Vector3<Scalar> transform_vector(const Vector3<Scalar>& v) const {
+        return Vector3<Scalar>([&] (size_t i) {
+            return matrix[i][0] * v[0] + matrix[i][1] * v[1] + matrix[i][2] * v[2];
+        });
+    }
+
+    Vector3<Scalar> transform_point(const Vector3<Scalar>& p) const {
+        return transform_vector(p) + Vector3<Scalar>(matrix[0][3], matrix[1][3], matrix[2][3]);
+    }
+
+    /// Transforms a normal with the transpose of the linear part of this transform.
+    /// Normals transform with the inverse transpose of the matrix applied to the surface,
+    /// so this must be called on the inverse of that matrix (e.g. a world-to-object transform).
+    Vector3<Scalar> transform_normal(const Vector3<Scalar>& n) const {
+        return Vector3<Scalar>([&] (size_t i) {
+            return matrix[0][i] * n[0] + matrix[1][i] * n[1] + matrix[2][i] * n[2];
+        });
+    }
+
+    /// Transforms the bounding box by transforming each of its corners.
+    BoundingBox<Scalar> transform_bounding_box(const BoundingBox<Scalar>& bbox) const {
+        auto result = BoundingBox<Scalar>::empty();
+        for (int i = 0; i < 8; ++i) {
+            result.extend(transform_point(Vector3<Scalar>(
+                (i & 1) ? bbox.max[0] : bbox.min[0],
+                (i & 2) ? bbox.max[1] : bbox.min[1],
+                (i & 4) ? bbox.max[2] : bbox.min[2])));
+        }
+        return result;
+    }
+
+    /// Transforms the origin and direction of the ray. The direction is not normalized,
+    /// so that distances along the transformed ray are the same as along the original one.
+    Ray<Scalar> transform_ray(const Ray<Scalar>& ray) const {
+        return Ray<Scalar>(transform_point(ray.origin), transform_vector(ray.direction), ray.tmin, ray.tmax);
+    }
+
+    /// Inverse of this transform. The linear part must be invertible.
+    AffineTransform inverse() const {
+        auto& m = matrix;
+        Vector3<Scalar> cofactors[3] = {
+            Vector3<Scalar>(
+                m[1][1] * m[2][2] - m[1][2] * m[2][1],
+                m[0][2] * m[2][1] - m[0][1] * m[2][2],
+                m[0][1] * m[1][2] - m[0][2] * m[1][1]),
+            Vector3<Scalar>(
+                m[1][2] * m[2][0] - m[1][0] * m[2][2],
+                m[0][0] * m[2][2] - m[0][2] * m[2][0],
+                m[0][2] * m[1][0] - m[0][0] * m[1][2]),
+            Vector3<Scalar>(
+                m[1][0] * m[2][1] - m[1][1] * m[2][0],
+                m[0][1] * m[2][0] - m[0][0] * m[2][1],
+                m[0][0] * m[1][1] - m[0][1] * m[1][0])
+        };
+        auto inv_det = Scalar(1) / (m[0][0] * cofactors[0][0] + m[0][1] * cofactors[1][0] + m[0][2] * cofactors[2][0]);
+        AffineTransform result;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j)
+                result.matrix[i][j] = cofactors[i][j] * inv_det;
+        }
+        auto t = result.transform_vector(Vector3<Scalar>(m[0][3], m[1][3], m[2][3]));
+        for (int i = 0; i < 3; ++i)
+            result.matrix[i][3] = -t[i];
+        return result;
+    }
+};
+
+/// Composes two transforms: the result applies `b` first, then `a`.
+template <typename Scalar>
+inline AffineTransform<Scalar> operator * (const AffineTransform<Scalar>& a, const AffineTransform<Scalar>& b) {
+    AffineTransform<Scalar> result;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            result.matrix[i][j] =
+                a.matrix[i][0] * b.matrix[0][j] +
+                a.matrix[i][1] * b.matrix[1][j] +
+                a.matrix[i][2] * b.matrix[2][j] +
+                (j == 3 ? a.matrix[i][3] : Scalar(0));
+        }
+    }
+    return result;
+}
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef BVH_APPROXIMATE_AGGLOMERATIVE_CLUSTERING_BUILDER_HPP
+#define BVH_APPROXIMATE_AGGLOMERATIVE_CLUSTERING_BUILDER_HPP
+
+#include <memory>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+
+#include "bvh/bvh.hpp"
+#include "bvh/bounding_box.hpp"
+#include "bvh/morton_code_based_builder.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// Bottom-up BVH builder based on "Efficient BVH Construction via Approximate Agglomerative
+/// Clustering", by Y. Gu et al. Primitives are sorted by Morton code, and recursively partitioned
+/// on the bits of their codes until the partitions are small enough. Clusters are then formed
+/// bottom-up: at every level of the recursion, the clusters coming from both partitions are greedily
+/// merged (closest pair first, where the distance is the area of the union of their bounding boxes)
+/// until only a bounded number of them remain. Independent partitions are processed in parallel.
+template <typename Bvh, typename Morton>
+class ApproximateAgglomerativeClusteringBuilder : public MortonCodeBasedBuilder<Bvh, Morton> {
+    using Scalar = typename Bvh::ScalarType;
+    using Node   = typename Bvh::Node;
+
+    using ParentBuilder = MortonCodeBasedBuilder<Bvh, Morton>;
+    using ParentBuilder::sort_primitives_by_morton_code;
+    using ParentBuilder::find_split;
+
+    Bvh& bvh;
+
+    /// Index of the next free pair of nodes in the BVH.
+    size_t next_node;
+
+    /// Returns the number of clusters that a partition of the given size is reduced to.
+    size_t reduced_cluster_count(size_t primitive_count) const {
+        auto alpha = Scalar(0.5) - epsilon;
+        auto c = std::pow(Scalar(leaf_threshold), Scalar(0.5) + epsilon) / Scalar(2);
+        return std::max(size_t(1), size_t(std::ceil(c * std::pow(Scalar(primitive_count), alpha))));
+    }
+
+    static Scalar distance(const Node& a, const Node& b) {
+        return a.bounding_box_proxy().to_bounding_box().extend(b.bounding_box_proxy()).half_area();
+    }
+
+    /// Finds the closest cluster to the cluster at index `i`, among the `count` first clusters.
+    static size_t find_closest(const Node* clusters, size_t count, size_t i) {
+        auto best_distance = std::numeric_limits<Scalar>::max();
+        size_t best_cluster = i;
+        for (size_t j = 0; j < count; ++j) {
+            if (j == i)
+                continue;
+            auto d = distance(clusters[i], clusters[j]);
+            if (d < best_distance) {
+                best_distance = d;
+                best_cluster = j;
+            }
+        }
+        return best_cluster;
+    }
+
+    /// Merges the given clusters until there are at most `target_count` of them left,
+    /// and returns the number of remaining clusters, which are stored at the beginning of the array.
+    size_t combine_clusters(Node* clusters, size_t* closest, size_t count, size_t target_count) {
+        if (count <= target_count)
+            return count;
+
+        for (size_t i = 0; i < count; ++i)
+            closest[i] = find_closest(clusters, count, i);
+
+        while (count > target_count) {
+            // Find the closest pair of clusters
+            auto best_distance = std::numeric_limits<Scalar>::max();
+            size_t left = 0, right = 0;
+            for (size_t i = 0; i < count; ++i) {
+                auto d = distance(clusters[i], clusters[closest[i]]);
+                if (d < best_distance) {
+                    best_distance = d;
+                    left  = std::min(i, closest[i]);
+                    right = std::max(i, closest[i]);
+                }
+            }
+
+            // Store both clusters in the BVH, and replace them by their parent
+            auto first_child = atomic_fetch_add(next_node, 2);
+            bvh.nodes[first_child + 0] = clusters[left];
+            bvh.nodes[first_child + 1] = clusters[right];
+            auto& parent = clusters[left];
+            parent.bounding_box_proxy() = clusters[left]
+                .bounding_box_proxy()
+                .to_bounding_box()
+                .extend(clusters[right].bounding_box_proxy());
+            parent.primitive_count = 0;
+            parent.first_child_or_primitive = first_child;
+
+            // The parent is stored at the place of the left cluster, which comes first
+            count--;
+            clusters[right] = clusters[count];
+            closest[right]  = closest[count];
+
+            // Update the neighbors that pointed to one of the merged clusters,
+            // or to the last cluster, which has been moved to the place of the right one.
+            for (size_t i = 0; i < count; ++i) {
+                if (i == left || closest[i] == left || closest[i] == right)
+                    closest[i] = find_closest(clusters, count, i);
+                else if (closest[i] == count)
+                    closest[i] = right;
+            }
+        }
+        return count;
+    }
+
+    /// Builds the clusters for the primitives in [begin, end[. The resulting clusters
+    /// are stored at the beginning of that range in the array of clusters.
+    size_t build_clusters(
+        Node* clusters,
+        size_t* closest,
+        const Morton* morton_codes,
+        const BoundingBox<Scalar>* bboxes,
+        size_t begin, size_t end)
+    {
+        size_t count = 0;
+        if (end - begin <= leaf_threshold) {
+            for (size_t i = begin; i < end; ++i) {
+                auto& node = clusters[i];
+                node.bounding_box_proxy()     = bboxes[bvh.primitive_indices[i]];
+                node.primitive_count          = 1;
+                node.first_child_or_primitive = i;
+            }
+            count = end - begin;
+        } else {
+            size_t split = find_split(morton_codes, begin, end);
+            size_t left_count = 0, right_count = 0;
+            #pragma omp task if (end - begin > task_spawn_threshold) shared(left_count)
+            { left_count = build_clusters(clusters, closest, morton_codes, bboxes, begin, split); }
+            right_count = build_clusters(clusters, closest, morton_codes, bboxes, split, end);
+            #pragma omp taskwait
+
+            std::copy(clusters + split, clusters + split + right_count, clusters + begin + left_count);
+            count = left_count + right_count;
+        }
+        return combine_clusters(clusters + begin, closest + begin, count, reduced_cluster_count(end - begin));
+    }
+
+public:
+    using ParentBuilder::loop_parallel_threshold;
+
+    /// Number of primitives under which partitions are not split anymore
+    /// (the parameter delta of the paper). Larger values give better trees,
+    /// at the expense of a longer build time.
+    size_t leaf_threshold = 4;
+
+    /// Parameter controlling how fast the number of clusters is reduced at every level
+    /// (the parameter epsilon of the paper). Smaller values keep more clusters, which gives
+    /// better trees, but longer build times. The paper recommends 4 and 0.2 for the "fast"
+    /// configuration, and 20 and 0.1 for the "high quality" one.
+    Scalar epsilon = Scalar(0.2);
+
+    /// Threshold (number of primitives) under which the builder
+    /// doesn't spawn any more OpenMP tasks.
+    size_t task_spawn_threshold = 1024;
+
+    ApproximateAgglomerativeClusteringBuilder(Bvh& bvh)
+        : bvh(bvh)
+    {}
+
+    void build(
+        const BoundingBox<Scalar>& global_bbox,
+        const BoundingBox<Scalar>* bboxes,
+        const Vector3<Scalar>* centers,
+        size_t primitive_count)
+    {
+        assert(primitive_count > 0);
+
+        std::unique_ptr<size_t[]> primitive_indices;
+        std::unique_ptr<Morton[]> morton_codes;
+
+        std::tie(primitive_indices, morton_codes) =
+            sort_primitives_by_morton_code(global_bbox, centers, primitive_count);
+
+        auto node_count = 2 * primitive_count - 1;
+        bvh.nodes = std::make_unique<Node[]>(node_count);
+        bvh.primitive_indices = std::move(primitive_indices);
+        bvh.node_count = node_count;
+
+        auto clusters = std::make_unique<Node[]>(primitive_count);
+        auto closest  = std::make_unique<size_t[]>(primitive_count);
+
+        next_node = 1;
+        size_t count = 0;
+        #pragma omp parallel
+        #pragma omp single
+        {
+            count = build_clusters(clusters.get(), closest.get(), morton_codes.get(), bboxes, 0, primitive_count);
+            count = combine_clusters(clusters.get(), closest.get(), count, 1);
+        }
+        assert(count == 1);
+        assert(next_node == node_count);
+        bvh.nodes[0] = clusters[0];
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef BVH_BIN_SCHEDULE_HPP
+#define BVH_BIN_SCHEDULE_HPP
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+namespace bvh {
+
+/// Number of bins used by a binned builder for the nodes at a given depth.
+/// Many bins close to the root, where the quality of the splits matters most,
+/// and fewer bins deeper in the tree, where nodes are small, give most of the
+/// quality of a large bin count for a fraction of the build time.
+class BinSchedule {
+    /// (First depth, bin count) pairs, sorted by depth.
+    std::vector<std::pair<size_t, size_t>> steps;
+
+public:
+    BinSchedule() = default;
+
+    /// Creates a schedule that uses the given number of bins at every depth.
+    explicit BinSchedule(size_t bin_count) {
+        set(0, bin_count);
+    }
+
+    /// Uses the given number of bins for the nodes at the given depth and deeper,
+    /// until the next depth that is present in the schedule.
+    BinSchedule& set(size_t first_depth, size_t bin_count) {
+        auto it = std::lower_bound(steps.begin(), steps.end(), std::make_pair(first_depth, size_t(0)));
+        if (it != steps.end() && it->first == first_depth)
+            it->second = bin_count;
+        else
+            steps.emplace(it, first_depth, bin_count);
+        return *this;
+    }
+
+    bool empty() const { return steps.empty(); }
+
+    /// Largest number of bins used at any depth.
+    size_t max_bin_count() const {
+        size_t max = 0;
+        for (auto& step : steps)
+            max = std::max(max, step.second);
+        return max;
+    }
+
+    /// Returns the number of bins to use for the nodes at the given depth,
+    /// or `default_bin_count` if no entry of the schedule applies.
+    size_t bin_count(size_t depth, size_t default_bin_count) const {
+        auto it = std::upper_bound(steps.begin(), steps.end(), std::make_pair(depth, ~size_t(0)));
+        return it == steps.begin() ? default_bin_count : std::prev(it)->second;
+    }
+};
+
+} // namespace bvh
+
+#endif
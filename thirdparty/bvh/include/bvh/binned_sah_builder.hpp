@@ -2,11 +2,16 @@
 #define BVH_BINNED_SAH_BUILDER_HPP
 
 #include <optional>
+#include <memory>
+#include <algorithm>
 
 #include "bvh/bvh.hpp"
 #include "bvh/bounding_box.hpp"
 #include "bvh/top_down_builder.hpp"
 #include "bvh/sah_based_algorithm.hpp"
+#include "bvh/platform.hpp"
+#include "bvh/simd.hpp"
+#include "bvh/bin_schedule.hpp"
 
 namespace bvh {
 
@@ -16,23 +21,60 @@ template <typename, size_t> class BinnedSahBuildTask;
 /// the SAH with bins of fixed size at every step of the recursion.
 /// See "On fast Construction of SAH-based Bounding Volume Hierarchies",
 /// by I. Wald.
+/// The template parameter `BinCount` is the largest number of bins the builder can use.
+/// The number of bins used at every depth can be lowered with `bin_schedule`.
 template <typename Bvh, size_t BinCount>
 class BinnedSahBuilder : public TopDownBuilder, public SahBasedAlgorithm<Bvh>
 {
     using Scalar    = typename Bvh::ScalarType;
     using BuildTask = BinnedSahBuildTask<Bvh, BinCount>;
 
-    using TopDownBuilder::run_task;
+    using TopDownBuilder::run_first_task;
 
     friend BuildTask;
 
+    /// Primitive data used by the SIMD binning kernel, in a form that can be loaded directly into packs.
+    /// Minimum coordinates are negated, so that bounding boxes can be extended with a single `max()`.
+    struct PackedPrimitive
+    {
+        Scalar bounds[8];        //< -min.x, -min.y, -min.z, -min.z, max.x, max.y, max.z, max.z
+        Scalar center_bounds[8]; //< Same layout, for the center of the primitive
+    };
+
     Bvh& bvh;
+    std::unique_ptr<PackedPrimitive[]> packed_primitives;
 
 public:
+    /// Bounds that are subdivided into bins, and implementation of the binning loop.
+    enum class Binning
+    {
+        /// Bins subdivide the bounding box of the node.
+        NodeBounds,
+        /// Bins subdivide the bounding box of the centers of the primitives in the node,
+        /// which gives tighter bins, and therefore better splits.
+        CenterBounds,
+        /// Same as `CenterBounds`, with a SIMD binning kernel working on a packed copy of the input.
+        SimdCenterBounds
+    };
+
+    Binning binning = Binning::NodeBounds;
+
+    /// Number of bins used for the nodes at every depth. Bin counts are clamped
+    /// to the range [2, BinCount], and depths that are not covered by the schedule use `BinCount` bins.
+    BinSchedule bin_schedule;
+
     using TopDownBuilder::max_depth;
     using TopDownBuilder::max_leaf_size;
     using SahBasedAlgorithm<Bvh>::traversal_cost;
 
+    /// Threshold (number of primitives) above which the binning and partitioning
+    /// of a single node are split into chunks processed by parallel tasks.
+    /// Below it, nodes are processed serially, in parallel with each other.
+    size_t parallel_binning_threshold = 1 << 16;
+
+    /// Minimum number of primitives per chunk, for nodes that are binned in parallel.
+    size_t parallel_binning_grain_size = 1 << 14;
+
     BinnedSahBuilder(Bvh& bvh)
         : bvh(bvh)
     {}
@@ -52,18 +94,48 @@ public:
         bvh.node_count = 1;
         bvh.nodes[0].bounding_box_proxy() = global_bbox;
 
+        if (binning == Binning::SimdCenterBounds)
+            packed_primitives = std::make_unique<PackedPrimitive[]>(primitive_count);
+
+        auto center_bbox = BoundingBox<Scalar>::empty();
+
         #pragma omp parallel
         {
             #pragma omp for
             for (size_t i = 0; i < primitive_count; ++i)
                 bvh.primitive_indices[i] = i;
 
-            #pragma omp single
+            if (binning != Binning::NodeBounds)
             {
-                BuildTask first_task(*this, bboxes, centers);
-                run_task(first_task, 0, 0, primitive_count, 0);
+                auto thread_center_bbox = BoundingBox<Scalar>::empty();
+                #pragma omp for nowait
+                for (size_t i = 0; i < primitive_count; ++i)
+                {
+                    thread_center_bbox.extend(centers[i]);
+                    if (packed_primitives)
+                        pack_primitive(bboxes[i], centers[i], packed_primitives[i]);
+                }
+                #pragma omp critical
+                center_bbox.extend(thread_center_bbox);
             }
         }
+
+        BuildTask first_task(*this, bboxes, centers);
+        run_first_task(first_task, 0, 0, primitive_count, 0, center_bbox);
+
+        packed_primitives.reset();
+    }
+
+private:
+    static void pack_primitive(const BoundingBox<Scalar>& bbox, const Vector3<Scalar>& center, PackedPrimitive& packed)
+    {
+        for (int axis = 0; axis < 4; ++axis)
+        {
+            packed.bounds[axis]            = -bbox.min[std::min(axis, 2)];
+            packed.bounds[axis + 4]        =  bbox.max[std::min(axis, 2)];
+            packed.center_bounds[axis]     = -center[std::min(axis, 2)];
+            packed.center_bounds[axis + 4] =  center[std::min(axis, 2)];
+        }
     }
 };
 
@@ -73,17 +145,75 @@ class BinnedSahBuildTask : public TopDownBuildTask
     using Scalar  = typename Bvh::ScalarType;
     using Builder = BinnedSahBuilder<Bvh, BinCount>;
 
-    using TopDownBuildTask::WorkItem;
+    using Binning         = typename Builder::Binning;
+    using PackedPrimitive = typename Builder::PackedPrimitive;
+
+    struct WorkItem : public TopDownBuildTask::WorkItem
+    {
+        /// Bounding box of the centers of the primitives, only maintained when binning over center bounds.
+        BoundingBox<Scalar> center_bbox;
+
+        WorkItem() = default;
+        WorkItem(size_t node_index, size_t begin, size_t end, size_t depth, const BoundingBox<Scalar>& center_bbox)
+            : TopDownBuildTask::WorkItem(node_index, begin, end, depth), center_bbox(center_bbox)
+        {}
+    };
 
     struct Bin
     {
         BoundingBox<Scalar> bbox;
+        BoundingBox<Scalar> center_bbox; //< only computed when binning over center bounds
         size_t primitive_count;
         Scalar right_cost; //< cost from right sweep, faciliate cost calculate
     };
 
-    static constexpr size_t bin_count = BinCount;
-    std::array<Bin, bin_count> bins_per_axis[3];
+    /// Maps the center of a primitive to a bin on every axis.
+    struct BinMapping
+    {
+        Vector3<Scalar> center_to_bin;
+        Vector3<Scalar> bin_offset;
+        Scalar packed_center_to_bin[4];
+        Scalar packed_bin_offset[4];
+        size_t bin_count;
+
+        BinMapping(const Vector3<Scalar>& center_to_bin, const Vector3<Scalar>& bin_offset, size_t bin_count)
+            : center_to_bin(center_to_bin), bin_offset(bin_offset), bin_count(bin_count)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                packed_center_to_bin[i] = center_to_bin[std::min(i, 2)];
+                packed_bin_offset[i]    = bin_offset[std::min(i, 2)];
+            }
+        }
+
+        size_t bin_index(const Vector3<Scalar>& center, int axis) const
+        {
+            auto bin_index = fast_multiply_add(center[axis], center_to_bin[axis], bin_offset[axis]);
+            return std::min(bin_count - 1, size_t(std::max(Scalar(0), bin_index)));
+        }
+
+        /// SIMD version of `bin_index()`, for the three axes at once. The result may differ from
+        /// `bin_index()` by one bin on boundaries, so the two versions must not be mixed in one build.
+        void bin_indices(const PackedPrimitive& primitive, size_t* indices) const
+        {
+            using Pack = bvh::Pack<Scalar, 4>;
+            Scalar values[4];
+            auto bin_index = multiply_add(
+                Pack::load(primitive.center_bounds + 4),
+                Pack::load(packed_center_to_bin),
+                Pack::load(packed_bin_offset));
+            max(bin_index, Pack(Scalar(0))).store(values);
+            for (int axis = 0; axis < 3; ++axis)
+                indices[axis] = std::min(bin_count - 1, size_t(values[axis]));
+        }
+    };
+
+    static constexpr size_t max_bin_count = BinCount;
+    using Bins = std::array<Bin, max_bin_count>;
+    Bins bins_per_axis[3];
+
+    /// Number of bins used for the node that is being built.
+    size_t bin_count = max_bin_count;
 
     Builder& builder;
     const BoundingBox<Scalar>* bboxes;
@@ -120,6 +250,164 @@ class BinnedSahBuildTask : public TopDownBuildTask
         return best_split;
     }
 
+    void fill_bins(Bins* bins, size_t begin, size_t end, const BinMapping& mapping) const
+    {
+        if (builder.binning == Binning::SimdCenterBounds)
+        {
+            fill_bins_simd(bins, begin, end, mapping);
+            return;
+        }
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (size_t j = 0; j < bin_count; ++j)
+            {
+                bins[axis][j].bbox = BoundingBox<Scalar>::empty();
+                bins[axis][j].center_bbox = BoundingBox<Scalar>::empty();
+                bins[axis][j].primitive_count = 0;
+            }
+        }
+
+        bool track_centers = builder.binning == Binning::CenterBounds;
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto primitive_index = builder.bvh.primitive_indices[i];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                Bin& bin = bins[axis][mapping.bin_index(centers[primitive_index], axis)];
+                bin.primitive_count++;
+                bin.bbox.extend(bboxes[primitive_index]);
+                if (track_centers)
+                    bin.center_bbox.extend(centers[primitive_index]);
+            }
+        }
+    }
+
+    /// Binning loop working on packed primitives (see `BinnedSahBuilder::PackedPrimitive`).
+    /// The bounding box of a primitive and of its center are each accumulated with one
+    /// `max()` on a pack of 8 values, and bin indices are computed for the three axes at once.
+    void fill_bins_simd(Bins* bins, size_t begin, size_t end, const BinMapping& mapping) const
+    {
+        using Pack = bvh::Pack<Scalar, 8>;
+
+        Pack bounds[3][max_bin_count];
+        Pack center_bounds[3][max_bin_count];
+        size_t counts[3][max_bin_count] = {};
+        for (int axis = 0; axis < 3; ++axis)
+            std::fill(bounds[axis], bounds[axis] + bin_count, Pack(-std::numeric_limits<Scalar>::max()));
+        for (int axis = 0; axis < 3; ++axis)
+            std::fill(center_bounds[axis], center_bounds[axis] + bin_count, Pack(-std::numeric_limits<Scalar>::max()));
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto& primitive = builder.packed_primitives[builder.bvh.primitive_indices[i]];
+            auto primitive_bounds = Pack::load(primitive.bounds);
+            auto primitive_center = Pack::load(primitive.center_bounds);
+            size_t indices[3];
+            mapping.bin_indices(primitive, indices);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                bounds[axis][indices[axis]]        = max(bounds[axis][indices[axis]], primitive_bounds);
+                center_bounds[axis][indices[axis]] = max(center_bounds[axis][indices[axis]], primitive_center);
+                counts[axis][indices[axis]]++;
+            }
+        }
+
+        auto unpack = [] (const Pack& pack)
+        {
+            Scalar values[8];
+            pack.store(values);
+            return BoundingBox<Scalar>(
+                Vector3<Scalar>(-values[0], -values[1], -values[2]),
+                Vector3<Scalar>( values[4],  values[5],  values[6]));
+        };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (size_t j = 0; j < bin_count; ++j)
+            {
+                bins[axis][j].bbox            = unpack(bounds[axis][j]);
+                bins[axis][j].center_bbox     = unpack(center_bounds[axis][j]);
+                bins[axis][j].primitive_count = counts[axis][j];
+            }
+        }
+    }
+
+    /// Bins the primitives of a large node with one task per chunk of primitives,
+    /// and merges the per-chunk bins into `bins_per_axis`.
+    void fill_bins_in_parallel(size_t begin, size_t end, size_t chunk_count, const BinMapping& mapping)
+    {
+        auto chunk_bins = std::make_unique<Bins[]>(3 * chunk_count);
+        size_t chunk_size = (end - begin + chunk_count - 1) / chunk_count;
+
+        builder.parallel_for(chunk_count, [&] (size_t i)
+        {
+            size_t chunk_begin = std::min(end, begin + i * chunk_size);
+            size_t chunk_end   = std::min(end, chunk_begin + chunk_size);
+            fill_bins(&chunk_bins[3 * i], chunk_begin, chunk_end, mapping);
+        });
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            bins_per_axis[axis] = chunk_bins[axis];
+            for (size_t i = 1; i < chunk_count; ++i)
+            {
+                for (size_t j = 0; j < bin_count; ++j)
+                {
+                    auto& bin   = bins_per_axis[axis][j];
+                    auto& other = chunk_bins[3 * i + axis][j];
+                    bin.bbox.extend(other.bbox);
+                    bin.center_bbox.extend(other.center_bbox);
+                    bin.primitive_count += other.primitive_count;
+                }
+            }
+        }
+    }
+
+    /// Partitions the primitive indices of a large node with one task per chunk of primitives.
+    /// Every chunk is partitioned in place, and the two halves of every chunk are then
+    /// moved to their final position through a temporary buffer.
+    template <typename Predicate>
+    size_t partition_in_parallel(size_t* primitive_indices, size_t begin, size_t end, size_t chunk_count, Predicate predicate)
+    {
+        auto left_counts = std::make_unique<size_t[]>(chunk_count);
+        auto buffer      = std::make_unique<size_t[]>(end - begin);
+        size_t chunk_size = (end - begin + chunk_count - 1) / chunk_count;
+
+        builder.parallel_for(chunk_count, [&] (size_t i)
+        {
+            auto chunk_begin = primitive_indices + std::min(end, begin + i * chunk_size);
+            auto chunk_end   = primitive_indices + std::min(end, begin + (i + 1) * chunk_size);
+            left_counts[i] = std::partition(chunk_begin, chunk_end, predicate) - chunk_begin;
+        });
+
+        size_t left_count = 0;
+        for (size_t i = 0; i < chunk_count; ++i)
+            left_count += left_counts[i];
+
+        builder.parallel_for(chunk_count, [&] (size_t i)
+        {
+            // Offsets of the chunk within the left and right groups
+            size_t left_offset = 0;
+            for (size_t j = 0; j < i; ++j)
+                left_offset += left_counts[j];
+            size_t right_offset = left_count + std::min(end - begin, i * chunk_size) - left_offset;
+
+            auto chunk_begin = primitive_indices + std::min(end, begin + i * chunk_size);
+            auto chunk_end   = primitive_indices + std::min(end, begin + (i + 1) * chunk_size);
+            std::copy(chunk_begin, chunk_begin + left_counts[i], buffer.get() + left_offset);
+            std::copy(chunk_begin + left_counts[i], chunk_end, buffer.get() + right_offset);
+        });
+
+        builder.parallel_for(chunk_count, [&] (size_t i)
+        {
+            size_t chunk_begin = std::min(end - begin, i * chunk_size);
+            size_t chunk_end   = std::min(end - begin, (i + 1) * chunk_size);
+            std::copy(buffer.get() + chunk_begin, buffer.get() + chunk_end, primitive_indices + begin + chunk_begin);
+        });
+
+        return begin + left_count;
+    }
+
 public:
     using WorkItemType = WorkItem;
 
@@ -148,38 +436,35 @@ public:
 
         std::pair<Scalar, size_t> best_splits[3];
 
-        auto bbox = node.bounding_box_proxy().to_bounding_box();
+        bool center_binning = builder.binning != Binning::NodeBounds;
+        auto bbox = center_binning ? item.center_bbox : node.bounding_box_proxy().to_bounding_box();
+        bin_count = std::clamp(builder.bin_schedule.bin_count(item.depth, max_bin_count), size_t(2), max_bin_count);
         auto center_to_bin = bbox.diagonal().inverse() * Scalar(bin_count);
-        auto bin_offset    = -bbox.min * center_to_bin;
-
-        //< [=] : capture by copy
-        auto compute_bin_index = [=] (const Vector3<Scalar>& center, int axis)
+        if (center_binning)
         {
-            auto bin_index = fast_multiply_add(center[axis], center_to_bin[axis], bin_offset[axis]);
-            return std::min(bin_count - 1, size_t(std::max(Scalar(0), bin_index)));
-        };
+            // The centers may all lie on a plane, in which case the bins are flat along that axis
+            auto diagonal = bbox.diagonal();
+            for (int axis = 0; axis < 3; ++axis)
+                center_to_bin[axis] = diagonal[axis] > Scalar(0) ? Scalar(bin_count) / diagonal[axis] : Scalar(0);
+        }
+        BinMapping mapping(center_to_bin, -bbox.min * center_to_bin, bin_count);
 
-        // Setup bins with empty bb
-        for (int axis = 0; axis < 3; ++axis)
+        // Large nodes (typically, the top levels of the tree) are binned and partitioned by
+        // several threads, since there are not enough nodes yet to keep all threads busy.
+        size_t chunk_count = 1;
+        if (item.work_size() >= builder.parallel_binning_threshold)
         {
-            for (auto& bin : bins_per_axis[axis]) //< fix-sized array
-            {
-                bin.bbox = BoundingBox<Scalar>::empty();
-                bin.primitive_count = 0;
-            }
+            chunk_count = std::min(
+                builder.node_thread_count(),
+                item.work_size() / std::max(builder.parallel_binning_grain_size, size_t(1)));
+            chunk_count = std::max(chunk_count, size_t(1));
         }
 
         // Fill bins with primitives
-        for (size_t i = item.begin; i < item.end; ++i)
-        {
-            auto primitive_index = bvh.primitive_indices[i];
-            for (int axis = 0; axis < 3; ++axis)
-            {
-                Bin& bin = bins_per_axis[axis][compute_bin_index(centers[primitive_index], axis)];
-                bin.primitive_count++;
-                bin.bbox.extend(bboxes[primitive_index]);
-            }
-        }
+        if (chunk_count > 1)
+            fill_bins_in_parallel(item.begin, item.end, chunk_count, mapping);
+        else
+            fill_bins(bins_per_axis, item.begin, item.end, mapping);
 
         // Determine best split axis
         for (int axis = 0; axis < 3; ++axis)
@@ -224,16 +509,26 @@ public:
         //< function : ForwardIt partition( ForwardIt first, ForwardIt last, UnaryPredicate p );
         //<     return value is Iterator to the first element of the second group.
         //< begin_right is "size of first group" and "first of second group".
-        size_t begin_right = std::partition(primitive_indices + item.begin, primitive_indices + item.end,
-            [&] (size_t i) { return compute_bin_index(centers[i], best_axis) < split_index; } ) - primitive_indices;
+        auto is_left = [&] (size_t i)
+        {
+            if (builder.binning == Binning::SimdCenterBounds)
+            {
+                // Use the same bin indices as the binning loop
+                size_t indices[3];
+                mapping.bin_indices(builder.packed_primitives[i], indices);
+                return indices[best_axis] < split_index;
+            }
+            return mapping.bin_index(centers[i], best_axis) < split_index;
+        };
+        size_t begin_right = chunk_count > 1
+            ? partition_in_parallel(primitive_indices, item.begin, item.end, chunk_count, is_left)
+            : std::partition(primitive_indices + item.begin, primitive_indices + item.end, is_left) - primitive_indices;
 
         // Check that the split does not make one group empty
         if (begin_right > item.begin && begin_right < item.end)
         {
             // Allocate two nodes
-            size_t first_child;
-            #pragma omp atomic capture
-            { first_child = bvh.node_count; bvh.node_count += 2; }
+            size_t first_child = atomic_fetch_add(bvh.node_count, 2);
 
             auto& left  = bvh.nodes[first_child + 0];
             auto& right = bvh.nodes[first_child + 1];
@@ -244,16 +539,25 @@ public:
             auto& bins = bins_per_axis[best_axis];
             auto left_bbox  = BoundingBox<Scalar>::empty();
             auto right_bbox = BoundingBox<Scalar>::empty();
-            for (size_t i = 0; i < best_splits[best_axis].second; ++i)
+            auto left_center_bbox  = BoundingBox<Scalar>::empty();
+            auto right_center_bbox = BoundingBox<Scalar>::empty();
+            for (size_t i = 0; i < split_index; ++i)
                 left_bbox.extend(bins[i].bbox);
             for (size_t i = split_index; i < bin_count; ++i)
                 right_bbox.extend(bins[i].bbox);
+            if (center_binning)
+            {
+                for (size_t i = 0; i < split_index; ++i)
+                    left_center_bbox.extend(bins[i].center_bbox);
+                for (size_t i = split_index; i < bin_count; ++i)
+                    right_center_bbox.extend(bins[i].center_bbox);
+            }
             left.bounding_box_proxy()  = left_bbox;
             right.bounding_box_proxy() = right_bbox;
 
             // Return new work items
-            WorkItem first_item (first_child + 0, item.begin, begin_right, item.depth + 1);
-            WorkItem second_item(first_child + 1, begin_right, item.end,   item.depth + 1);
+            WorkItem first_item (first_child + 0, item.begin, begin_right, item.depth + 1, left_center_bbox);
+            WorkItem second_item(first_child + 1, begin_right, item.end,   item.depth + 1, right_center_bbox);
             return std::make_optional(std::make_pair(first_item, second_item));
         }
 
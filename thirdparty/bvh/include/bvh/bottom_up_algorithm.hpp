@@ -65,24 +65,49 @@ protected:
                 continue;
 
             process_leaf(i);
+            process_ancestors(i, process_inner_node);
+        }
+    }
+
+    /// Same as above, but starts from the given list of leaves instead of searching for leaves
+    /// in the array of nodes. This is necessary for algorithms that move nodes around while
+    /// traversing the tree, since a leaf could otherwise be found again at its new position.
+    template <typename ProcessLeaf, typename ProcessInnerNode>
+    void traverse_in_parallel(
+        const size_t* leaves,
+        size_t leaf_count,
+        const ProcessLeaf& process_leaf,
+        const ProcessInnerNode& process_inner_node)
+    {
+        bvh::assert_in_parallel();
 
-            // Process inner nodes on the path from that leaf up to the root
-            size_t j = i;
-            do {
-                j = parents[j];
-
-                // Make sure that the children of this inner node have been processed
-                int previous_flag;
-                #pragma omp atomic capture
-                { previous_flag = flags[j]; flags[j]++; }
-                if (previous_flag != 1)
-                    break;
-                flags[j] = 0;
-
-                process_inner_node(j);
-            } while (j != 0);
+        #pragma omp for
+        for (size_t i = 0; i < leaf_count; ++i) {
+            process_leaf(leaves[i]);
+            if (leaves[i] != 0)
+                process_ancestors(leaves[i], process_inner_node);
         }
     }
+
+private:
+    template <typename ProcessInnerNode>
+    void process_ancestors(size_t i, const ProcessInnerNode& process_inner_node) {
+        // Process inner nodes on the path from that leaf up to the root
+        size_t j = i;
+        do {
+            j = parents[j];
+
+            // Make sure that the children of this inner node have been processed
+            int previous_flag;
+            #pragma omp atomic capture
+            { previous_flag = flags[j]; flags[j]++; }
+            if (previous_flag != 1)
+                break;
+            flags[j] = 0;
+
+            process_inner_node(j);
+        } while (j != 0);
+    }
 };
 
 } // namespace bvh
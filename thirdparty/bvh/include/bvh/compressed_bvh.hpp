@@ -0,0 +1,113 @@
+#ifndef BVH_COMPRESSED_BVH_HPP
+#define BVH_COMPRESSED_BVH_HPP
+
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "bvh/bvh.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// A BVH with the same topology as `bvh::Bvh`, where the bounds of every node are quantized
+/// to 8 bits, relative to the (decoded) bounding box of its parent. The bounds of the root are
+/// stored separately, in full precision. Quantization is conservative: decoded boxes always
+/// contain the original ones, so that traversal never misses an intersection. Since decoding
+/// requires the bounds of the parent, nodes must be decoded top-down, during traversal.
+/// This is usually obtained by converting a regular BVH (see `bvh::CompressedBvhConverter`).
+template <typename Scalar>
+struct CompressedBvh
+{
+    using IndexType  = typename SizedIntegerType<sizeof(Scalar) * CHAR_BIT>::Unsigned;
+    using ScalarType = Scalar;
+
+    /// Node with decoded bounds, as used by the traversal algorithms.
+    using DecodedNode = typename Bvh<Scalar>::Node;
+
+    static constexpr unsigned max_quantized_value = 255;
+
+    /// Maximum number of primitives in a leaf, limited by the width of `Node::primitive_count`.
+    static constexpr size_t max_leaf_size = std::numeric_limits<uint16_t>::max();
+
+    // The size of this structure should be 12 bytes in
+    // single precision and 16 bytes in double precision.
+    struct Node
+    {
+        uint8_t   quantized_bounds[6];
+        uint16_t  primitive_count;
+        IndexType first_child_or_primitive;
+
+        bool is_leaf() const { return primitive_count != 0; }
+    };
+
+    /// Size of a quantization step for the children of a node with the given bounds on an axis.
+    static Scalar quantization_step(Scalar min, Scalar max) {
+        return (max - min) * (Scalar(1) / Scalar(max_quantized_value));
+    }
+
+    // The minimum (resp. maximum) is decoded from the minimum (resp. maximum) of the
+    // parent, so that the extreme quantized values decode exactly to the parent bounds.
+    static Scalar decode_min(unsigned q, Scalar min, Scalar step) {
+        return fast_multiply_add(Scalar(q), step, min);
+    }
+
+    static Scalar decode_max(unsigned q, Scalar max, Scalar step) {
+        return fast_multiply_add(-Scalar(max_quantized_value - q), step, max);
+    }
+
+    /// Decodes the bounds of a node, given the decoded bounds of its parent.
+    static void decode(const Node& node, const Scalar* parent_bounds, Scalar* bounds) {
+        for (int axis = 0; axis < 3; ++axis) {
+            auto min  = parent_bounds[axis * 2 + 0];
+            auto max  = parent_bounds[axis * 2 + 1];
+            auto step = quantization_step(min, max);
+            bounds[axis * 2 + 0] = decode_min(node.quantized_bounds[axis * 2 + 0], min, step);
+            bounds[axis * 2 + 1] = decode_max(node.quantized_bounds[axis * 2 + 1], max, step);
+        }
+    }
+
+    /// Quantizes the given bounds conservatively, relative to the decoded bounds of the parent.
+    /// Returns false if the bounds are not contained in the bounds of the parent, since they
+    /// cannot be quantized conservatively in that case.
+    static bool encode(const Scalar* bounds, const Scalar* parent_bounds, uint8_t* quantized_bounds) {
+        for (int axis = 0; axis < 3; ++axis) {
+            auto min  = parent_bounds[axis * 2 + 0];
+            auto max  = parent_bounds[axis * 2 + 1];
+            auto step = quantization_step(min, max);
+            auto lower = bounds[axis * 2 + 0];
+            auto upper = bounds[axis * 2 + 1];
+            if (!(lower >= min && upper <= max))
+                return false;
+
+            // Start from an estimate and then fix it, since the decoding
+            // functions are monotonic but not exactly invertible.
+            int q_min = 0, q_max = max_quantized_value;
+            if (step > 0) {
+                q_min = std::clamp(int(std::floor((lower - min) / step)), 0, int(max_quantized_value));
+                q_max = std::clamp(int(max_quantized_value) - int(std::floor((max - upper) / step)), 0, int(max_quantized_value));
+            }
+            while (q_min > 0 && decode_min(q_min, min, step) > lower) q_min--;
+            while (q_min < int(max_quantized_value) && decode_min(q_min + 1, min, step) <= lower) q_min++;
+            while (q_max < int(max_quantized_value) && decode_max(q_max, max, step) < upper) q_max++;
+            while (q_max > 0 && decode_max(q_max - 1, max, step) >= upper) q_max--;
+            quantized_bounds[axis * 2 + 0] = uint8_t(q_min);
+            quantized_bounds[axis * 2 + 1] = uint8_t(q_max);
+        }
+        return true;
+    }
+
+    Scalar root_bounds[6];
+
+    std::unique_ptr<Node[]>   nodes;
+    std::unique_ptr<size_t[]> primitive_indices;
+
+    size_t node_count = 0;
+};
+
+} // namespace bvh
+
+#endif
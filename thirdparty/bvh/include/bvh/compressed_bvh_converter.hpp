@@ -0,0 +1,86 @@
+#ifndef BVH_COMPRESSED_BVH_CONVERTER_HPP
+#define BVH_COMPRESSED_BVH_CONVERTER_HPP
+
+#include <vector>
+#include <limits>
+
+#include "bvh/bvh.hpp"
+#include "bvh/compressed_bvh.hpp"
+
+namespace bvh {
+
+/// Converts a BVH into a compressed BVH with quantized bounds (see `bvh::CompressedBvh`).
+/// The node indices are preserved, so that the topology and the leaves are the same.
+/// Conversion fails when a leaf has more than `CompressedBvh::max_leaf_size` primitives
+/// (which binned builders produce when many centroids coincide), or when the bounds of
+/// a child are not contained in the bounds of its parent.
+template <typename Bvh>
+class CompressedBvhConverter
+{
+    using Scalar        = typename Bvh::ScalarType;
+    using CompressedBvh = bvh::CompressedBvh<Scalar>;
+
+    CompressedBvh& compressed_bvh;
+
+public:
+    CompressedBvhConverter(CompressedBvh& compressed_bvh)
+        : compressed_bvh(compressed_bvh)
+    {}
+
+    /// Converts the given BVH. Returns false if it cannot be compressed,
+    /// in which case the compressed BVH must not be used.
+    bool convert(const Bvh& bvh)
+    {
+        assert(bvh.node_count > 0);
+
+        compressed_bvh.nodes = std::make_unique<typename CompressedBvh::Node[]>(bvh.node_count);
+        compressed_bvh.node_count = bvh.node_count;
+        std::copy(bvh.nodes[0].bounds, bvh.nodes[0].bounds + 6, compressed_bvh.root_bounds);
+
+        // Nodes are processed top-down, since the children of a node are
+        // quantized relative to its bounds, as seen by the traversal algorithm.
+        struct Element {
+            size_t index;
+            Scalar parent_bounds[6];
+        };
+        std::vector<Element> stack;
+        stack.emplace_back();
+        stack.back().index = 0;
+        std::copy(compressed_bvh.root_bounds, compressed_bvh.root_bounds + 6, stack.back().parent_bounds);
+
+        size_t primitive_count = 0;
+        while (!stack.empty()) {
+            auto element = stack.back();
+            stack.pop_back();
+
+            const auto& node = bvh.nodes[element.index];
+            auto& compressed_node = compressed_bvh.nodes[element.index];
+            if (!CompressedBvh::encode(node.bounds, element.parent_bounds, compressed_node.quantized_bounds) ||
+                node.primitive_count > CompressedBvh::max_leaf_size)
+                return false;
+            compressed_node.primitive_count          = uint16_t(node.primitive_count);
+            compressed_node.first_child_or_primitive = node.first_child_or_primitive;
+
+            if (node.is_leaf()) {
+                primitive_count = std::max(primitive_count, size_t(node.first_child_or_primitive + node.primitive_count));
+                continue;
+            }
+
+            Scalar bounds[6];
+            CompressedBvh::decode(compressed_node, element.parent_bounds, bounds);
+            for (size_t i = 0; i < 2; ++i) {
+                stack.emplace_back();
+                stack.back().index = node.first_child_or_primitive + i;
+                std::copy(bounds, bounds + 6, stack.back().parent_bounds);
+            }
+        }
+
+        compressed_bvh.primitive_indices = std::make_unique<size_t[]>(primitive_count);
+        std::copy(bvh.primitive_indices.get(), bvh.primitive_indices.get() + primitive_count, compressed_bvh.primitive_indices.get());
+        return true;
+    }
+};
+
+} // namespace bvh
+
+#endif
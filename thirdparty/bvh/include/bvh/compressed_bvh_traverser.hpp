@@ -0,0 +1,199 @@
+#ifndef BVH_COMPRESSED_BVH_TRAVERSER_HPP
+#define BVH_COMPRESSED_BVH_TRAVERSER_HPP
+
+#include <cassert>
+#include <optional>
+
+#include "bvh/compressed_bvh.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/node_intersectors.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// Single ray traversal algorithm for compressed BVHs. This is the same algorithm as
+/// `SingleRayTraverser`, except that the stack also contains the decoded bounds of the
+/// parent of every pushed pair of nodes, since they are needed to decode the children.
+template <typename CompressedBvh, size_t StackSize = 64>
+class CompressedBvhTraverser
+{
+public:
+    static constexpr size_t stack_size = StackSize;
+
+private:
+    using Scalar          = typename CompressedBvh::ScalarType;
+    using Node            = typename CompressedBvh::Node;
+    using DecodedNode     = typename CompressedBvh::DecodedNode;
+    using NodeIntersector = CompressedNodeIntersector<CompressedBvh>;
+
+    struct Stack {
+        struct Element {
+            typename CompressedBvh::IndexType first_child;
+            Scalar parent_bounds[6];
+        };
+
+        Element elements[stack_size];
+        size_t size = 0;
+
+        void push(typename CompressedBvh::IndexType first_child, const Scalar* parent_bounds) {
+            assert(size < stack_size);
+            elements[size].first_child = first_child;
+            std::copy(parent_bounds, parent_bounds + 6, elements[size].parent_bounds);
+            size++;
+        }
+
+        const Element& pop() {
+            assert(!empty());
+            return elements[--size];
+        }
+
+        bool empty() const { return size == 0; }
+    };
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>& intersect_leaf(
+        const Node& node,
+        Ray<Scalar>& ray,
+        std::optional<typename PrimitiveIntersector::Result>& best_hit,
+        PrimitiveIntersector& primitive_intersector,
+        Statistics& statistics) const
+    {
+        assert(node.is_leaf());
+        size_t begin = node.first_child_or_primitive;
+        size_t end   = begin + node.primitive_count;
+        statistics.intersections += end - begin;
+        if constexpr (PrimitiveIntersector::intersects_leaves) {
+            if (auto hit = primitive_intersector.intersect_leaf(begin, end, ray)) {
+                best_hit = hit;
+                ray.tmax = hit->distance();
+            }
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                if (auto hit = primitive_intersector.intersect(i, ray)) {
+                    best_hit = hit;
+                    if (primitive_intersector.any_hit)
+                        return best_hit;
+                    ray.tmax = hit->distance();
+                }
+            }
+        }
+        return best_hit;
+    }
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    intersect(Ray<Scalar> ray, PrimitiveIntersector& primitive_intersector, Statistics& statistics) const
+    {
+        auto best_hit = std::optional<typename PrimitiveIntersector::Result>(std::nullopt);
+
+        // If the root is a leaf, intersect it and return
+        if (bvh_unlikely(bvh.nodes[0].is_leaf()))
+            return intersect_leaf(bvh.nodes[0], ray, best_hit, primitive_intersector, statistics);
+
+        NodeIntersector node_intersector(ray);
+
+        // The decoded bounds of the root are exactly the root bounds
+        Stack stack;
+        Scalar parent_bounds[6];
+        std::copy(bvh.root_bounds, bvh.root_bounds + 6, parent_bounds);
+        auto* left_child = &bvh.nodes[bvh.nodes[0].first_child_or_primitive];
+        while (true) {
+            statistics.traversal_steps++;
+
+            auto* right_child = left_child + 1;
+            DecodedNode decoded_left, decoded_right;
+            auto distance_left  = node_intersector.intersect(*left_child,  parent_bounds, decoded_left,  ray);
+            auto distance_right = node_intersector.intersect(*right_child, parent_bounds, decoded_right, ray);
+
+            if (distance_left.first <= distance_left.second) {
+                if (bvh_unlikely(left_child->is_leaf())) {
+                    if (intersect_leaf(*left_child, ray, best_hit, primitive_intersector, statistics) &&
+                        primitive_intersector.any_hit)
+                        break;
+                    left_child = nullptr;
+                }
+            } else
+                left_child = nullptr;
+
+            if (distance_right.first <= distance_right.second) {
+                if (bvh_unlikely(right_child->is_leaf())) {
+                    if (intersect_leaf(*right_child, ray, best_hit, primitive_intersector, statistics) &&
+                        primitive_intersector.any_hit)
+                        break;
+                    right_child = nullptr;
+                }
+            } else
+                right_child = nullptr;
+
+            if (left_child) {
+                const DecodedNode* decoded_near = &decoded_left;
+                if (right_child) {
+                    const DecodedNode* decoded_far = &decoded_right;
+                    if (distance_left.first > distance_right.first) {
+                        std::swap(left_child, right_child);
+                        std::swap(decoded_near, decoded_far);
+                    }
+                    stack.push(right_child->first_child_or_primitive, decoded_far->bounds);
+                }
+                std::copy(decoded_near->bounds, decoded_near->bounds + 6, parent_bounds);
+                left_child = &bvh.nodes[left_child->first_child_or_primitive];
+            } else if (right_child) {
+                std::copy(decoded_right.bounds, decoded_right.bounds + 6, parent_bounds);
+                left_child = &bvh.nodes[right_child->first_child_or_primitive];
+            } else {
+                if (stack.empty())
+                    break;
+                const auto& element = stack.pop();
+                std::copy(element.parent_bounds, element.parent_bounds + 6, parent_bounds);
+                left_child = &bvh.nodes[element.first_child];
+            }
+        }
+
+        return best_hit;
+    }
+
+    const CompressedBvh& bvh;
+
+public:
+    /// Statistics collected during traversal.
+    struct Statistics {
+        size_t traversal_steps = 0;
+        size_t intersections   = 0;
+    };
+
+    CompressedBvhTraverser(const CompressedBvh& bvh)
+        : bvh(bvh)
+    {}
+
+    /// Intersects the BVH with the given ray and intersector.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& intersector) const
+    {
+        struct {
+            struct Empty {
+                Empty& operator ++ (int)    { return *this; }
+                Empty& operator ++ ()       { return *this; }
+                Empty& operator += (size_t) { return *this; }
+            } traversal_steps, intersections;
+        } statistics;
+        return intersect(ray, intersector, statistics);
+    }
+
+    /// Intersects the BVH with the given ray and intersector.
+    /// Record statistics on the number of traversal and intersection steps.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& primitive_intersector, Statistics& statistics) const
+    {
+        return intersect(ray, primitive_intersector, statistics);
+    }
+};
+
+} // namespace bvh
+
+#endif
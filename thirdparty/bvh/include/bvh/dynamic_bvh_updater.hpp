@@ -0,0 +1,330 @@
+#ifndef BVH_DYNAMIC_BVH_UPDATER_HPP
+#define BVH_DYNAMIC_BVH_UPDATER_HPP
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <cassert>
+
+#include "bvh/bvh.hpp"
+#include "bvh/bounding_box.hpp"
+
+namespace bvh {
+
+/// Inserts and removes primitives from an existing BVH, without rebuilding it.
+/// Primitives are inserted next to the node that minimizes the increase in SAH cost, which
+/// is found with the branch-and-bound search described in "Fast Insertion-Based Optimization
+/// of Bounding Volume Hierarchies", by J. Bittner et al. After every insertion or removal,
+/// the ancestors of the modified node are refitted, and the tree rotations of "Fast, Effective
+/// BVH Updates for Animated Scenes", by D. Kopta et al., are applied along the way to limit
+/// the degradation of the tree.
+/// The BVH stays valid after every operation: nodes are kept contiguous, and the leaves
+/// contain one primitive each, referenced by its index in `primitive_indices`, which is
+/// the identity. This makes the BVH usable by every traverser and algorithm of the library.
+template <typename Bvh>
+class DynamicBvhUpdater {
+    using Scalar = typename Bvh::ScalarType;
+    using Node   = typename Bvh::Node;
+
+    static constexpr size_t invalid_index = std::numeric_limits<size_t>::max();
+
+    Bvh& bvh;
+
+    size_t node_capacity = 0;
+    size_t primitive_capacity = 0;
+
+    std::vector<size_t> parents;
+
+    /// Index of the leaf that contains every primitive, or `invalid_index` if it is not in the BVH.
+    std::vector<size_t> leaves;
+
+    /// Priority queue for the search of the best sibling.
+    std::vector<std::pair<Scalar, size_t>> queue;
+
+    static Scalar half_area(const Node& node) {
+        return node.bounding_box_proxy().half_area();
+    }
+
+    static BoundingBox<Scalar> merge(const Node& a, const Node& b) {
+        return a.bounding_box_proxy().to_bounding_box().extend(b.bounding_box_proxy());
+    }
+
+    void reserve_nodes(size_t node_count) {
+        if (node_count <= node_capacity)
+            return;
+        node_capacity = std::max(node_count, node_capacity * 2);
+        auto nodes = std::make_unique<Node[]>(node_capacity);
+        std::copy(bvh.nodes.get(), bvh.nodes.get() + bvh.node_count, nodes.get());
+        bvh.nodes = std::move(nodes);
+        parents.resize(node_capacity);
+    }
+
+    void reserve_primitives(size_t primitive_count) {
+        if (primitive_count <= primitive_capacity)
+            return;
+        auto new_capacity = std::max(primitive_count, primitive_capacity * 2);
+        auto primitive_indices = std::make_unique<size_t[]>(new_capacity);
+        for (size_t i = 0; i < new_capacity; ++i)
+            primitive_indices[i] = i;
+        bvh.primitive_indices = std::move(primitive_indices);
+        primitive_capacity = new_capacity;
+        leaves.resize(primitive_capacity, invalid_index);
+    }
+
+    /// Updates the references to the node at the given index, after it has been moved there.
+    void relink(size_t index) {
+        auto& node = bvh.nodes[index];
+        if (node.is_leaf()) {
+            leaves[node.first_child_or_primitive] = index;
+        } else {
+            parents[node.first_child_or_primitive + 0] = index;
+            parents[node.first_child_or_primitive + 1] = index;
+        }
+    }
+
+    /// Creates the leaves for the primitives of a leaf of the original BVH,
+    /// below the given node, and returns the bounding box of that node.
+    BoundingBox<Scalar> expand_leaf(size_t index, const size_t* primitives, size_t count, const BoundingBox<Scalar>* bboxes) {
+        auto& node = bvh.nodes[index];
+        if (count == 1) {
+            node.bounding_box_proxy()     = bboxes[primitives[0]];
+            node.primitive_count          = 1;
+            node.first_child_or_primitive = primitives[0];
+            leaves[primitives[0]] = index;
+            return bboxes[primitives[0]];
+        }
+
+        size_t first_child = bvh.node_count;
+        bvh.node_count += 2;
+        parents[first_child + 0] = index;
+        parents[first_child + 1] = index;
+        auto bbox = expand_leaf(first_child + 0, primitives, count / 2, bboxes);
+        bbox.extend(expand_leaf(first_child + 1, primitives + count / 2, count - count / 2, bboxes));
+        auto& parent = bvh.nodes[index];
+        parent.bounding_box_proxy()     = bbox;
+        parent.primitive_count          = 0;
+        parent.first_child_or_primitive = first_child;
+        return bbox;
+    }
+
+    /// Finds the node that minimizes the SAH cost when used as the sibling of the given bounding box.
+    size_t find_best_sibling(const BoundingBox<Scalar>& bbox) {
+        auto area = bbox.half_area();
+        size_t best_sibling = 0;
+        auto best_cost = std::numeric_limits<Scalar>::max();
+
+        // The queue is ordered by the area that is added to the ancestors of every node,
+        // which is a lower bound on the cost of inserting the primitive below that node.
+        auto compare = std::greater<std::pair<Scalar, size_t>>();
+        queue.clear();
+        queue.emplace_back(Scalar(0), 0);
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), compare);
+            auto [inherited_cost, index] = queue.back();
+            queue.pop_back();
+            if (inherited_cost + area >= best_cost)
+                break;
+
+            auto& node = bvh.nodes[index];
+            auto direct_cost = BoundingBox<Scalar>(bbox).extend(node.bounding_box_proxy()).half_area();
+            auto cost = inherited_cost + direct_cost;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_sibling = index;
+            }
+
+            auto child_inherited_cost = cost - half_area(node);
+            if (!node.is_leaf() && child_inherited_cost + area < best_cost) {
+                for (size_t i = 0; i < 2; ++i) {
+                    queue.emplace_back(child_inherited_cost, node.first_child_or_primitive + i);
+                    std::push_heap(queue.begin(), queue.end(), compare);
+                }
+            }
+        }
+        return best_sibling;
+    }
+
+    /// Swaps a child of the given node with one of the children of its sibling,
+    /// if that reduces the area of that sibling.
+    void rotate(size_t index) {
+        auto first_child = bvh.nodes[index].first_child_or_primitive;
+        Scalar best_gain = 0;
+        size_t best_child = 0, best_grandchild = 0;
+        for (size_t i = 0; i < 2; ++i) {
+            auto child = first_child + i;
+            auto other = first_child + 1 - i;
+            auto& other_node = bvh.nodes[other];
+            if (other_node.is_leaf())
+                continue;
+            for (size_t j = 0; j < 2; ++j) {
+                auto grandchild = other_node.first_child_or_primitive + j;
+                auto kept       = other_node.first_child_or_primitive + 1 - j;
+                auto gain = half_area(other_node) - merge(bvh.nodes[child], bvh.nodes[kept]).half_area();
+                if (gain > best_gain) {
+                    best_gain       = gain;
+                    best_child      = child;
+                    best_grandchild = grandchild;
+                }
+            }
+        }
+        if (best_gain <= 0)
+            return;
+
+        std::swap(bvh.nodes[best_child], bvh.nodes[best_grandchild]);
+        relink(best_child);
+        relink(best_grandchild);
+        auto other = bvh.sibling(best_child);
+        auto first_grandchild = bvh.nodes[other].first_child_or_primitive;
+        bvh.nodes[other].bounding_box_proxy() = merge(bvh.nodes[first_grandchild], bvh.nodes[first_grandchild + 1]);
+    }
+
+    /// Refits the given node and its ancestors, and applies rotations on the way up.
+    void refit_from(size_t index) {
+        while (true) {
+            auto& node = bvh.nodes[index];
+            auto first_child = node.first_child_or_primitive;
+            node.bounding_box_proxy() = merge(bvh.nodes[first_child], bvh.nodes[first_child + 1]);
+            rotate(index);
+            if (index == 0)
+                break;
+            index = parents[index];
+        }
+    }
+
+    /// Removes the pair of nodes starting at the given index, by moving the last pair
+    /// of nodes in its place. Returns the new index of the given node if it was moved.
+    size_t free_pair(size_t first_child, size_t tracked_index) {
+        auto last = bvh.node_count - 2;
+        if (first_child != last) {
+            bvh.nodes[parents[last]].first_child_or_primitive = first_child;
+            for (size_t i = 0; i < 2; ++i) {
+                bvh.nodes[first_child + i] = bvh.nodes[last + i];
+                parents[first_child + i] = parents[last];
+                relink(first_child + i);
+            }
+            if (tracked_index == last || tracked_index == last + 1)
+                tracked_index = first_child + tracked_index - last;
+        }
+        bvh.node_count -= 2;
+        return tracked_index;
+    }
+
+public:
+    /// Creates an updater for the given BVH, which may be empty. Leaves that contain more than
+    /// one primitive are split, which requires the bounding boxes of the primitives. Every
+    /// primitive must be referenced at most once in the BVH (i.e. no spatial splits).
+    DynamicBvhUpdater(Bvh& bvh, const BoundingBox<Scalar>* bboxes = nullptr)
+        : bvh(bvh)
+    {
+        if (bvh.node_count == 0)
+            return;
+
+        size_t primitive_count = 0, max_primitive = 0;
+        for (size_t i = 0; i < bvh.node_count; ++i) {
+            auto& node = bvh.nodes[i];
+            if (!node.is_leaf())
+                continue;
+            primitive_count += node.primitive_count;
+            for (size_t j = 0; j < node.primitive_count; ++j)
+                max_primitive = std::max(max_primitive, bvh.primitive_indices[node.first_child_or_primitive + j]);
+        }
+
+        // Leaves are replaced by subtrees of leaves with one primitive each
+        auto primitive_indices = std::move(bvh.primitive_indices);
+        reserve_primitives(max_primitive + 1);
+        auto original_node_count = bvh.node_count;
+        reserve_nodes(2 * primitive_count - 1);
+        parents[0] = 0;
+        for (size_t i = 0; i < original_node_count; ++i) {
+            auto& node = bvh.nodes[i];
+            if (node.is_leaf()) {
+                assert(node.primitive_count == 1 || bboxes);
+                auto primitives = primitive_indices.get() + node.first_child_or_primitive;
+                if (node.primitive_count == 1) {
+                    assert(leaves[primitives[0]] == invalid_index);
+                    node.first_child_or_primitive = primitives[0];
+                    leaves[primitives[0]] = i;
+                } else
+                    expand_leaf(i, primitives, node.primitive_count, bboxes);
+            } else {
+                parents[node.first_child_or_primitive + 0] = i;
+                parents[node.first_child_or_primitive + 1] = i;
+            }
+        }
+    }
+
+    bool contains(size_t primitive_index) const {
+        return primitive_index < leaves.size() && leaves[primitive_index] != invalid_index;
+    }
+
+    /// Inserts a primitive with the given bounding box in the BVH.
+    void insert(size_t primitive_index, const BoundingBox<Scalar>& bbox) {
+        reserve_primitives(primitive_index + 1);
+        assert(!contains(primitive_index));
+
+        Node leaf;
+        leaf.bounding_box_proxy()     = bbox;
+        leaf.primitive_count          = 1;
+        leaf.first_child_or_primitive = primitive_index;
+
+        if (bvh.node_count == 0) {
+            reserve_nodes(1);
+            bvh.nodes[0] = leaf;
+            bvh.node_count = 1;
+            parents[0] = 0;
+            leaves[primitive_index] = 0;
+            return;
+        }
+
+        // The sibling is moved to a new pair of nodes, with the new leaf,
+        // and its old position is used for their parent.
+        auto sibling = find_best_sibling(bbox);
+        reserve_nodes(bvh.node_count + 2);
+        auto first_child = bvh.node_count;
+        bvh.node_count += 2;
+        bvh.nodes[first_child + 0] = bvh.nodes[sibling];
+        bvh.nodes[first_child + 1] = leaf;
+        parents[first_child + 0] = sibling;
+        parents[first_child + 1] = sibling;
+        relink(first_child + 0);
+        relink(first_child + 1);
+
+        auto& parent = bvh.nodes[sibling];
+        parent.primitive_count          = 0;
+        parent.first_child_or_primitive = first_child;
+        refit_from(sibling);
+    }
+
+    /// Removes the given primitive from the BVH.
+    void remove(size_t primitive_index) {
+        assert(contains(primitive_index));
+        auto leaf = leaves[primitive_index];
+        leaves[primitive_index] = invalid_index;
+        if (leaf == 0) {
+            bvh.node_count = 0;
+            return;
+        }
+
+        // The sibling of the leaf takes the place of their parent
+        auto parent = parents[leaf];
+        auto first_child = bvh.nodes[parent].first_child_or_primitive;
+        bvh.nodes[parent] = bvh.nodes[bvh.sibling(leaf)];
+        relink(parent);
+        parent = free_pair(first_child, parent);
+        if (parent != 0)
+            refit_from(parents[parent]);
+    }
+
+    /// Moves a primitive that is already in the BVH to a new bounding box.
+    void update(size_t primitive_index, const BoundingBox<Scalar>& bbox) {
+        remove(primitive_index);
+        insert(primitive_index, bbox);
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef BVH_HIERARCHICAL_LINEAR_BVH_BUILDER_HPP
+#define BVH_HIERARCHICAL_LINEAR_BVH_BUILDER_HPP
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cassert>
+
+#include "bvh/bvh.hpp"
+#include "bvh/morton_code_based_builder.hpp"
+#include "bvh/binned_sah_builder.hpp"
+
+namespace bvh {
+
+/// Hybrid builder based on "HLBVH: Hierarchical LBVH Construction for Real-Time Ray Tracing
+/// of Dynamic Geometry", by J. Pantaleoni and D. Luebke, with the SAH-optimized top levels
+/// of "Simpler and Faster HLBVH with Work Queues", by K. Garanzha et al.
+/// Primitives are sorted by Morton code, and grouped into clusters of primitives that share
+/// the most significant bits of their code. The bottom of the hierarchy is built in parallel,
+/// one cluster at a time, by splitting on the remaining bits of the Morton codes (as in
+/// `LinearBvhBuilder`). The top of the hierarchy is built over the clusters with a binned SAH builder.
+template <typename Bvh, typename Morton, size_t BinCount = 16>
+class HierarchicalLinearBvhBuilder : public MortonCodeBasedBuilder<Bvh, Morton> {
+    using Scalar = typename Bvh::ScalarType;
+    using Node   = typename Bvh::Node;
+
+    using ParentBuilder = MortonCodeBasedBuilder<Bvh, Morton>;
+    using ParentBuilder::sort_primitives_by_morton_code;
+    using ParentBuilder::bit_count;
+    using ParentBuilder::find_split;
+
+    Bvh& bvh;
+
+    /// Builds the hierarchy of a cluster (or part of it), and returns its bounding box.
+    /// The children of every node are allocated from `next_node`.
+    BoundingBox<Scalar> build_cluster(
+        size_t node_index,
+        size_t begin, size_t end,
+        size_t& next_node,
+        const Morton* morton_codes,
+        const BoundingBox<Scalar>* bboxes)
+    {
+        auto& node = bvh.nodes[node_index];
+        if (end - begin == 1) {
+            auto bbox = bboxes[bvh.primitive_indices[begin]];
+            node.bounding_box_proxy()     = bbox;
+            node.primitive_count          = 1;
+            node.first_child_or_primitive = begin;
+            return bbox;
+        }
+
+        size_t split = find_split(morton_codes, begin, end);
+        size_t first_child = next_node;
+        next_node += 2;
+
+        auto bbox = build_cluster(first_child + 0, begin, split, next_node, morton_codes, bboxes);
+        bbox.extend(build_cluster(first_child + 1, split, end,   next_node, morton_codes, bboxes));
+        node.bounding_box_proxy()     = bbox;
+        node.primitive_count          = 0;
+        node.first_child_or_primitive = first_child;
+        return bbox;
+    }
+
+    /// Copies the top hierarchy into the BVH, and records the index of the node
+    /// that every cluster replaces. Leaves of the top hierarchy that contain more
+    /// than one cluster are split in the middle until they contain a single one.
+    void copy_top_hierarchy(
+        const Bvh& top_bvh,
+        const BoundingBox<Scalar>* cluster_bboxes,
+        size_t* cluster_nodes,
+        const size_t* clusters, size_t cluster_count,
+        size_t source_index, size_t node_index,
+        size_t& next_node)
+    {
+        auto& source = top_bvh.nodes[source_index];
+        auto& node   = bvh.nodes[node_index];
+        if (source.is_leaf() && clusters == nullptr) {
+            clusters      = top_bvh.primitive_indices.get() + source.first_child_or_primitive;
+            cluster_count = source.primitive_count;
+        }
+
+        if (clusters != nullptr && cluster_count == 1) {
+            cluster_nodes[clusters[0]] = node_index;
+            return;
+        }
+
+        size_t first_child = next_node;
+        next_node += 2;
+        node.primitive_count          = 0;
+        node.first_child_or_primitive = first_child;
+        if (clusters == nullptr) {
+            node.bounding_box_proxy() = source.bounding_box_proxy().to_bounding_box();
+            for (size_t i = 0; i < 2; ++i) {
+                copy_top_hierarchy(
+                    top_bvh, cluster_bboxes, cluster_nodes, nullptr, 0,
+                    source.first_child_or_primitive + i, first_child + i, next_node);
+            }
+        } else {
+            auto bbox = BoundingBox<Scalar>::empty();
+            for (size_t i = 0; i < cluster_count; ++i)
+                bbox.extend(cluster_bboxes[clusters[i]]);
+            node.bounding_box_proxy() = bbox;
+            size_t half = cluster_count / 2;
+            copy_top_hierarchy(
+                top_bvh, cluster_bboxes, cluster_nodes,
+                clusters, half, source_index, first_child + 0, next_node);
+            copy_top_hierarchy(
+                top_bvh, cluster_bboxes, cluster_nodes,
+                clusters + half, cluster_count - half, source_index, first_child + 1, next_node);
+        }
+    }
+
+public:
+    using ParentBuilder::loop_parallel_threshold;
+
+    /// Number of most significant bits of the Morton codes that are shared by the primitives
+    /// of a cluster. More bits give more, smaller clusters, and more of the hierarchy is built
+    /// with the SAH. Using a multiple of 3 gives clusters of the same shape on every axis.
+    size_t cluster_bit_count = 15;
+
+    HierarchicalLinearBvhBuilder(Bvh& bvh)
+        : bvh(bvh)
+    {}
+
+    void build(
+        const BoundingBox<Scalar>& global_bbox,
+        const BoundingBox<Scalar>* bboxes,
+        const Vector3<Scalar>* centers,
+        size_t primitive_count)
+    {
+        assert(primitive_count > 0);
+
+        std::unique_ptr<size_t[]> primitive_indices;
+        std::unique_ptr<Morton[]> morton_codes;
+
+        std::tie(primitive_indices, morton_codes) =
+            sort_primitives_by_morton_code(global_bbox, centers, primitive_count);
+
+        // Group primitives into clusters, which are ranges of primitives in Morton order
+        size_t cluster_shift = 3 * bit_count - std::min(cluster_bit_count, 3 * bit_count);
+        std::vector<size_t> cluster_begins(1, 0);
+        for (size_t i = 1; i < primitive_count; ++i) {
+            if ((morton_codes[i] >> cluster_shift) != (morton_codes[i - 1] >> cluster_shift))
+                cluster_begins.push_back(i);
+        }
+        cluster_begins.push_back(primitive_count);
+        size_t cluster_count = cluster_begins.size() - 1;
+
+        auto cluster_bboxes   = std::make_unique<BoundingBox<Scalar>[]>(cluster_count);
+        auto cluster_centers  = std::make_unique<Vector3<Scalar>[]>(cluster_count);
+        auto cluster_nodes    = std::make_unique<size_t[]>(cluster_count);
+        auto cluster_children = std::make_unique<size_t[]>(cluster_count);
+
+        #pragma omp parallel for if (cluster_count > loop_parallel_threshold)
+        for (size_t i = 0; i < cluster_count; ++i) {
+            auto bbox = BoundingBox<Scalar>::empty();
+            for (size_t j = cluster_begins[i]; j < cluster_begins[i + 1]; ++j)
+                bbox.extend(bboxes[primitive_indices[j]]);
+            cluster_bboxes[i]  = bbox;
+            cluster_centers[i] = bbox.center();
+        }
+
+        // Build the top of the hierarchy, over the clusters. Leaves are made as small as possible,
+        // since the root of every cluster takes the place of the leaf that contains it.
+        Bvh top_bvh;
+        BinnedSahBuilder<Bvh, BinCount> top_builder(top_bvh);
+        top_builder.max_leaf_size = 1;
+        top_builder.build(global_bbox, cluster_bboxes.get(), cluster_centers.get(), cluster_count);
+
+        // The final hierarchy has 2 * n - 1 nodes: 2 * c - 1 for the top levels,
+        // and 2 * m - 2 for the nodes below the root of each cluster of m primitives.
+        size_t node_count = 2 * primitive_count - 1;
+        bvh.nodes = std::make_unique<Node[]>(node_count);
+        bvh.primitive_indices = std::move(primitive_indices);
+        bvh.node_count = node_count;
+
+        size_t next_node = 1;
+        copy_top_hierarchy(top_bvh, cluster_bboxes.get(), cluster_nodes.get(), nullptr, 0, 0, 0, next_node);
+        assert(next_node == 2 * cluster_count - 1);
+        for (size_t i = 0; i < cluster_count; ++i) {
+            cluster_children[i] = next_node;
+            next_node += 2 * (cluster_begins[i + 1] - cluster_begins[i]) - 2;
+        }
+        assert(next_node == node_count);
+
+        // Build the bottom of the hierarchy, one cluster at a time
+        #pragma omp parallel for schedule(dynamic) if (cluster_count > 1)
+        for (size_t i = 0; i < cluster_count; ++i) {
+            size_t next_child = cluster_children[i];
+            build_cluster(
+                cluster_nodes[i],
+                cluster_begins[i], cluster_begins[i + 1],
+                next_child,
+                morton_codes.get(), bboxes);
+        }
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef BVH_INSTANCE_HPP
+#define BVH_INSTANCE_HPP
+
+#include "bvh/bvh.hpp"
+#include "bvh/vector.hpp"
+#include "bvh/bounding_box.hpp"
+#include "bvh/affine_transform.hpp"
+
+namespace bvh {
+
+/// Instance of a mesh, placed in the scene with an affine transform. A mesh is made of a
+/// bottom-level BVH and of the primitives it refers to, and can be shared by any number of instances.
+/// Instances are the primitives of the top-level BVH of a two-level acceleration structure
+/// (see `bvh::ClosestInstanceIntersector`), so that memory and construction time only grow
+/// with the amount of unique geometry, and not with the number of instances.
+template <typename Bvh, typename Primitive>
+struct Instance {
+    using ScalarType = typename Bvh::ScalarType;
+
+    const Bvh* bvh = nullptr;
+    const Primitive* primitives = nullptr;
+
+    AffineTransform<ScalarType> object_to_world;
+    AffineTransform<ScalarType> world_to_object;
+
+    /// Bounding box of the instance, in world space.
+    BoundingBox<ScalarType> bbox;
+
+    Instance() = default;
+    Instance(const Bvh& bvh, const Primitive* primitives, const AffineTransform<ScalarType>& object_to_world)
+        : bvh(&bvh)
+        , primitives(primitives)
+        , object_to_world(object_to_world)
+        , world_to_object(object_to_world.inverse())
+        , bbox(object_to_world.transform_bounding_box(bvh.nodes[0].bounding_box_proxy().to_bounding_box()))
+    {}
+
+    BoundingBox<ScalarType> bounding_box() const {
+        return bbox;
+    }
+
+    Vector3<ScalarType> center() const {
+        return bbox.center();
+    }
+
+    /// Transforms a normal of the mesh into world space.
+    Vector3<ScalarType> normal_to_world(const Vector3<ScalarType>& normal) const {
+        return world_to_object.transform_normal(normal);
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef BVH_INSTANCE_INTERSECTORS_HPP
+#define BVH_INSTANCE_INTERSECTORS_HPP
+
+#include <optional>
+
+#include "bvh/ray.hpp"
+#include "bvh/instance.hpp"
+#include "bvh/primitive_intersectors.hpp"
+#include "bvh/single_ray_traverser.hpp"
+
+namespace bvh {
+
+/// An intersector for the top-level BVH of a two-level acceleration structure, whose primitives
+/// are instances (see `bvh::Instance`). When the top-level traverser reaches an instance, the ray
+/// is transformed into the space of the instance, and the bottom-level BVH is traversed with
+/// `BottomTraverser`. Since transformed directions are not normalized, the distances along the
+/// ray are the same in both spaces, and the closest hit so far culls the following instances.
+/// The `Permuted` flag applies to the primitives of the meshes, not to the instances.
+template <typename Bvh, typename Primitive, bool Permuted = false, typename BottomTraverser = SingleRayTraverser<Bvh>>
+struct ClosestInstanceIntersector : public PrimitiveIntersector<Bvh, Instance<Bvh, Primitive>, false, false>
+{
+    using Scalar       = typename Bvh::ScalarType;
+    using Intersection = typename Primitive::IntersectionType;
+
+    struct Result
+    {
+        size_t       instance_index;
+        size_t       primitive_index;
+        Intersection intersection;
+
+        Scalar distance() const { return intersection.distance(); }
+    };
+
+    ClosestInstanceIntersector(const Bvh& bvh, const Instance<Bvh, Primitive>* instances)
+        : PrimitiveIntersector<Bvh, Instance<Bvh, Primitive>, false, false>(bvh, instances)
+    {}
+
+    std::optional<Result> intersect(size_t index, const Ray<Scalar>& ray) const
+    {
+        auto [instance, i] = this->primitive_at(index);
+        BottomTraverser traverser(*instance.bvh);
+        ClosestPrimitiveIntersector<Bvh, Primitive, Permuted> intersector(*instance.bvh, instance.primitives);
+        if (auto hit = traverser.traverse(instance.world_to_object.transform_ray(ray), intersector))
+            return std::make_optional(Result { i, hit->primitive_index, hit->intersection });
+        return std::nullopt;
+    }
+};
+
+/// An intersector for the top-level BVH of a two-level acceleration structure,
+/// that exits after the first hit and only stores the distance to the primitive.
+template <typename Bvh, typename Primitive, bool Permuted = false, typename BottomTraverser = SingleRayTraverser<Bvh>>
+struct AnyInstanceIntersector : public PrimitiveIntersector<Bvh, Instance<Bvh, Primitive>, false, true>
+{
+    using Scalar = typename Bvh::ScalarType;
+
+    struct Result
+    {
+        Scalar t;
+        Scalar distance() const { return t; }
+    };
+
+    AnyInstanceIntersector(const Bvh& bvh, const Instance<Bvh, Primitive>* instances)
+        : PrimitiveIntersector<Bvh, Instance<Bvh, Primitive>, false, true>(bvh, instances)
+    {}
+
+    std::optional<Result> intersect(size_t index, const Ray<Scalar>& ray) const
+    {
+        auto& instance = this->primitive_at(index).first;
+        BottomTraverser traverser(*instance.bvh);
+        AnyPrimitiveIntersector<Bvh, Primitive, Permuted> intersector(*instance.bvh, instance.primitives);
+        if (auto hit = traverser.traverse(instance.world_to_object.transform_ray(ray), intersector))
+            return std::make_optional(Result { hit->distance() });
+        return std::nullopt;
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -4,12 +4,14 @@
 #include <algorithm>
 #include <memory>
 #include <cassert>
+#include <climits>
 #include <type_traits>
 
 #include "bvh/bounding_box.hpp"
 #include "bvh/vector.hpp"
 #include "bvh/morton.hpp"
 #include "bvh/radix_sort.hpp"
+#include "bvh/utilities.hpp"
 
 namespace bvh {
 
@@ -40,6 +42,20 @@ protected:
 
     ~MortonCodeBasedBuilder() {}
 
+    /// Returns the index of the first primitive of the second child of a node
+    /// made of the primitives in [begin, end[ (see "Maximizing Parallelism in
+    /// the Construction of BVHs, Octrees, and k-d Trees", by T. Karras).
+    static size_t find_split(const Morton* morton_codes, size_t begin, size_t end) {
+        auto first = morton_codes[begin];
+        auto last  = morton_codes[end - 1];
+        if (first == last)
+            return (begin + end) / 2;
+        // Codes are sorted, so they all share the bits above the highest bit where `first` and `last` differ
+        auto bit = Morton(1) << (sizeof(Morton) * CHAR_BIT - 1 - count_leading_zeros(Morton(first ^ last)));
+        return std::partition_point(morton_codes + begin, morton_codes + end,
+            [bit] (Morton code) { return (code & bit) == 0; }) - morton_codes;
+    }
+
     SortedPairs sort_primitives_by_morton_code(
         const BoundingBox<Scalar>& global_bbox,
         const Vector3<Scalar>* centers,
@@ -2,6 +2,7 @@
 #define BVH_NODE_INTERSECTORS_HPP
 
 #include <cmath>
+#include <cassert>
 
 #include "bvh/vector.hpp"
 #include "bvh/ray.hpp"
@@ -111,6 +112,95 @@ struct FastNodeIntersector : public NodeIntersector<Bvh, FastNodeIntersector<Bvh
     using NodeIntersector<Bvh, FastNodeIntersector<Bvh>>::intersect;
 };
 
+/// Returns the octant of the given direction: bit `i` is set when component `i` is negative.
+/// This matches the classification done in `NodeIntersector`.
+template <typename Scalar>
+bvh_always_inline
+inline size_t compute_octant(const Vector3<Scalar>& direction) {
+    return
+        (size_t(std::signbit(direction[0])) << 0) |
+        (size_t(std::signbit(direction[1])) << 1) |
+        (size_t(std::signbit(direction[2])) << 2);
+}
+
+/// Same algorithm as `FastNodeIntersector`, for rays of a fixed octant (see `compute_octant()`).
+/// Since the octant is known at compile time, the selection of the near and far planes
+/// of a node does not require any index computation during traversal.
+template <typename Bvh, size_t Octant>
+struct OctantNodeIntersector
+{
+    using Scalar = typename Bvh::ScalarType;
+
+    static_assert(Octant < 8);
+
+    Vector3<Scalar> scaled_origin;
+    Vector3<Scalar> inverse_direction;
+
+    OctantNodeIntersector(const Ray<Scalar>& ray)
+    {
+        assert(compute_octant(ray.direction) == Octant);
+        inverse_direction = ray.direction.safe_inverse();
+        scaled_origin     = -ray.origin * inverse_direction;
+    }
+
+    template <size_t Axis, bool IsMin>
+    bvh_always_inline
+    Scalar intersect_axis(const typename Bvh::Node& node) const
+    {
+        static constexpr size_t near = (Octant >> Axis) & 1;
+        static constexpr size_t plane = Axis * 2 + (IsMin ? near : 1 - near);
+        return fast_multiply_add(node.bounds[plane], inverse_direction[Axis], scaled_origin[Axis]);
+    }
+
+    bvh_always_inline
+    std::pair<Scalar, Scalar> intersect(const typename Bvh::Node& node, const Ray<Scalar>& ray) const
+    {
+        auto entry_x = intersect_axis<0, true >(node);
+        auto entry_y = intersect_axis<1, true >(node);
+        auto entry_z = intersect_axis<2, true >(node);
+        auto exit_x  = intersect_axis<0, false>(node);
+        auto exit_y  = intersect_axis<1, false>(node);
+        auto exit_z  = intersect_axis<2, false>(node);
+        // Same order for the min/max operations as in `NodeIntersector`
+        return std::make_pair(
+            robust_max(robust_max(entry_x, entry_y), robust_max(entry_z, ray.tmin)),
+            robust_min(robust_min(exit_x,  exit_y),  robust_min(exit_z,  ray.tmax)));
+    }
+};
+
+/// Ray-node intersection algorithm for compressed BVHs (see `bvh::CompressedBvh`).
+/// The bounds of the node are decoded on the fly from the bounds of its parent,
+/// and then intersected with the same algorithm as `FastNodeIntersector`.
+template <typename CompressedBvh>
+struct CompressedNodeIntersector
+{
+    using Scalar      = typename CompressedBvh::ScalarType;
+    using DecodedNode = typename CompressedBvh::DecodedNode;
+
+    struct DecodedBvh {
+        using ScalarType = Scalar;
+        using Node       = DecodedNode;
+    };
+
+    FastNodeIntersector<DecodedBvh> node_intersector;
+
+    CompressedNodeIntersector(const Ray<Scalar>& ray)
+        : node_intersector(ray)
+    {}
+
+    /// Intersects the given node, and writes its decoded bounds in `decoded_node`.
+    bvh_always_inline
+    std::pair<Scalar, Scalar> intersect(
+        const typename CompressedBvh::Node& node,
+        const Scalar* parent_bounds,
+        DecodedNode& decoded_node,
+        const Ray<Scalar>& ray) const
+    {
+        CompressedBvh::decode(node, parent_bounds, decoded_node.bounds);
+        return node_intersector.intersect(decoded_node, ray);
+    }
+};
+
 } // namespace bvh
 
 #endif
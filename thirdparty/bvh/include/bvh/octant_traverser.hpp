@@ -0,0 +1,93 @@
+#ifndef BVH_OCTANT_TRAVERSER_HPP
+#define BVH_OCTANT_TRAVERSER_HPP
+
+#include <optional>
+
+#include "bvh/bvh.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/node_intersectors.hpp"
+#include "bvh/single_ray_traverser.hpp"
+
+namespace bvh {
+
+/// Single ray traversal algorithm where the node intersector is specialized for each ray
+/// octant (see `OctantNodeIntersector`). The octant is computed once per ray, which then
+/// selects one of the 8 instantiations of the traversal loop of `SingleRayTraverser`.
+template <typename Bvh, size_t StackSize = 64>
+class OctantTraverser
+{
+    using Scalar = typename Bvh::ScalarType;
+
+    template <size_t Octant>
+    using Traverser = SingleRayTraverser<Bvh, StackSize, OctantNodeIntersector<Bvh, Octant>>;
+
+    template <size_t Octant, bool CollectStatistics, typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse_octant(const Ray<Scalar>& ray, PrimitiveIntersector& intersector, Statistics& statistics) const
+    {
+        Traverser<Octant> traverser(bvh);
+        if constexpr (CollectStatistics) {
+            typename Traverser<Octant>::Statistics octant_statistics;
+            auto hit = traverser.traverse(ray, intersector, octant_statistics);
+            statistics.traversal_steps += octant_statistics.traversal_steps;
+            statistics.intersections   += octant_statistics.intersections;
+            return hit;
+        } else
+            return traverser.traverse(ray, intersector);
+    }
+
+    template <bool CollectStatistics, typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    dispatch(const Ray<Scalar>& ray, PrimitiveIntersector& intersector, Statistics& statistics) const
+    {
+        switch (compute_octant(ray.direction)) {
+            case 0:  return traverse_octant<0, CollectStatistics>(ray, intersector, statistics);
+            case 1:  return traverse_octant<1, CollectStatistics>(ray, intersector, statistics);
+            case 2:  return traverse_octant<2, CollectStatistics>(ray, intersector, statistics);
+            case 3:  return traverse_octant<3, CollectStatistics>(ray, intersector, statistics);
+            case 4:  return traverse_octant<4, CollectStatistics>(ray, intersector, statistics);
+            case 5:  return traverse_octant<5, CollectStatistics>(ray, intersector, statistics);
+            case 6:  return traverse_octant<6, CollectStatistics>(ray, intersector, statistics);
+            default: return traverse_octant<7, CollectStatistics>(ray, intersector, statistics);
+        }
+    }
+
+    const Bvh& bvh;
+
+public:
+    static constexpr size_t stack_size = StackSize;
+
+    /// Statistics collected during traversal.
+    struct Statistics {
+        size_t traversal_steps = 0;
+        size_t intersections   = 0;
+    };
+
+    OctantTraverser(const Bvh& bvh)
+        : bvh(bvh)
+    {}
+
+    /// Intersects the BVH with the given ray and intersector.
+    template <typename PrimitiveIntersector>
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& intersector) const
+    {
+        Statistics statistics;
+        return dispatch<false>(ray, intersector, statistics);
+    }
+
+    /// Intersects the BVH with the given ray and intersector.
+    /// Record statistics on the number of traversal and intersection steps.
+    template <typename PrimitiveIntersector>
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& intersector, Statistics& statistics) const
+    {
+        return dispatch<true>(ray, intersector, statistics);
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef BVH_PACKET_TRAVERSER_HPP
+#define BVH_PACKET_TRAVERSER_HPP
+
+#include <cassert>
+#include <optional>
+
+#include "bvh/bvh.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/simd.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// Ray packet traversal algorithm. All the rays of a packet share one traversal stack,
+/// and every node is intersected with all the active rays of the packet at once, using
+/// the SIMD instructions selected at compile time (see `bvh/simd.hpp`). This is only
+/// beneficial for coherent rays, such as primary rays. Primitives are intersected one
+/// ray at a time, using the same primitive intersectors as `SingleRayTraverser`.
+template <typename Bvh, size_t PacketSize, size_t StackSize = 64>
+class PacketTraverser
+{
+public:
+    static constexpr size_t packet_size = PacketSize;
+    static constexpr size_t stack_size  = StackSize;
+
+    static_assert(PacketSize <= 32, "The active lanes of a packet are stored in a 32-bit mask");
+
+private:
+    using Scalar = typename Bvh::ScalarType;
+    using Pack   = bvh::Pack<Scalar, PacketSize>;
+    using Lanes  = uint32_t;
+
+    static constexpr Lanes all_lanes = Lanes(-1) >> (32 - PacketSize);
+
+    struct Stack {
+        using Element = typename Bvh::IndexType;
+
+        Element elements[stack_size];
+        size_t size = 0;
+
+        void push(const Element& t) {
+            assert(size < stack_size);
+            elements[size++] = t;
+        }
+
+        Element pop() {
+            assert(!empty());
+            return elements[--size];
+        }
+
+        bool empty() const { return size == 0; }
+    };
+
+    /// Packet data in SoA form, with the same precomputations as `FastNodeIntersector`.
+    struct Packet {
+        Ray<Scalar> rays[PacketSize] {};
+        Scalar tmax[PacketSize];
+        Pack scaled_origin[3];
+        Pack inverse_direction[3];
+        Pack packed_tmin;
+        Pack packed_tmax;
+
+        Packet(const Ray<Scalar>* input_rays, size_t ray_count) {
+            assert(ray_count > 0 && ray_count <= PacketSize);
+            Scalar tmin[PacketSize];
+            Scalar values[6][PacketSize];
+            for (size_t i = 0; i < PacketSize; ++i) {
+                // Unused lanes are filled with a copy of the first ray that can never hit anything
+                rays[i] = input_rays[i < ray_count ? i : 0];
+                if (i >= ray_count)
+                    rays[i].tmax = -std::numeric_limits<Scalar>::max();
+                auto inverse_direction = rays[i].direction.safe_inverse();
+                for (int axis = 0; axis < 3; ++axis) {
+                    values[axis + 0][i] = inverse_direction[axis];
+                    values[axis + 3][i] = -rays[i].origin[axis] * inverse_direction[axis];
+                }
+                tmin[i] = rays[i].tmin;
+                tmax[i] = rays[i].tmax;
+            }
+            for (int axis = 0; axis < 3; ++axis) {
+                inverse_direction[axis] = Pack::load(values[axis + 0]);
+                scaled_origin[axis]     = Pack::load(values[axis + 3]);
+            }
+            packed_tmin = Pack::load(tmin);
+            packed_tmax = Pack::load(tmax);
+        }
+
+        void set_tmax(size_t lane, Scalar t) {
+            rays[lane].tmax = tmax[lane] = t;
+        }
+
+        void update_tmax() { packed_tmax = Pack::load(tmax); }
+    };
+
+    /// Returns the lanes that intersect the node, along with the entry distance of each lane.
+    bvh_always_inline
+    std::pair<Lanes, Pack> intersect_node(const typename Bvh::Node& node, const Packet& packet) const {
+        Pack entry = packet.packed_tmin;
+        Pack exit  = packet.packed_tmax;
+        for (int axis = 0; axis < 3; ++axis) {
+            auto t0 = multiply_add(Pack(node.bounds[axis * 2 + 0]), packet.inverse_direction[axis], packet.scaled_origin[axis]);
+            auto t1 = multiply_add(Pack(node.bounds[axis * 2 + 1]), packet.inverse_direction[axis], packet.scaled_origin[axis]);
+            entry = max(min(t0, t1), entry);
+            exit  = min(max(t0, t1), exit);
+        }
+        return std::make_pair(Lanes((entry <= exit).bits()), entry);
+    }
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    void intersect_leaf(
+        const typename Bvh::Node& node,
+        Lanes lanes,
+        Packet& packet,
+        std::optional<typename PrimitiveIntersector::Result>* hits,
+        Lanes& terminated,
+        PrimitiveIntersector& primitive_intersector,
+        Statistics& statistics) const
+    {
+        assert(node.is_leaf());
+        size_t begin = node.first_child_or_primitive;
+        size_t end   = begin + node.primitive_count;
+        if constexpr (PrimitiveIntersector::intersects_leaves) {
+            // The whole leaf is intersected with one ray at a time
+            for (Lanes remaining = lanes; remaining; remaining &= remaining - 1) {
+                size_t lane = first_bit_set(remaining);
+                statistics.intersections += end - begin;
+                if (auto hit = primitive_intersector.intersect_leaf(begin, end, packet.rays[lane])) {
+                    hits[lane] = hit;
+                    if (primitive_intersector.any_hit) {
+                        packet.set_tmax(lane, -std::numeric_limits<Scalar>::max());
+                        terminated |= Lanes(1) << lane;
+                    } else
+                        packet.set_tmax(lane, hit->distance());
+                }
+            }
+        } else {
+            for (size_t i = begin; i < end && lanes; ++i) {
+                for (Lanes remaining = lanes; remaining; remaining &= remaining - 1) {
+                    size_t lane = first_bit_set(remaining);
+                    statistics.intersections++;
+                    if (auto hit = primitive_intersector.intersect(i, packet.rays[lane])) {
+                        hits[lane] = hit;
+                        if (primitive_intersector.any_hit) {
+                            // Terminated rays are disabled by giving them an empty range
+                            packet.set_tmax(lane, -std::numeric_limits<Scalar>::max());
+                            terminated |= Lanes(1) << lane;
+                            lanes &= ~(Lanes(1) << lane);
+                        } else
+                            packet.set_tmax(lane, hit->distance());
+                    }
+                }
+            }
+        }
+        packet.update_tmax();
+    }
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    void intersect(
+        Packet& packet,
+        Lanes active,
+        std::optional<typename PrimitiveIntersector::Result>* hits,
+        PrimitiveIntersector& primitive_intersector,
+        Statistics& statistics) const
+    {
+        Lanes terminated = ~active & all_lanes;
+
+        // If the root is a leaf, intersect it and return
+        if (bvh_unlikely(bvh.nodes[0].is_leaf())) {
+            intersect_leaf(bvh.nodes[0], active, packet, hits, terminated, primitive_intersector, statistics);
+            return;
+        }
+
+        // Same eager traversal loop as `SingleRayTraverser`, except that the decisions
+        // are taken for the whole packet: a child is visited if any ray intersects it.
+        Stack stack;
+        auto* left_child = &bvh.nodes[bvh.nodes[0].first_child_or_primitive];
+        while (true) {
+            statistics.traversal_steps++;
+
+            auto* right_child = left_child + 1;
+            auto [lanes_left,  entry_left]  = intersect_node(*left_child,  packet);
+            auto [lanes_right, entry_right] = intersect_node(*right_child, packet);
+
+            if (lanes_left) {
+                if (bvh_unlikely(left_child->is_leaf())) {
+                    intersect_leaf(*left_child, lanes_left, packet, hits, terminated, primitive_intersector, statistics);
+                    if (primitive_intersector.any_hit && terminated == all_lanes)
+                        break;
+                    left_child = nullptr;
+                }
+            } else
+                left_child = nullptr;
+
+            if (lanes_right) {
+                if (bvh_unlikely(right_child->is_leaf())) {
+                    intersect_leaf(*right_child, lanes_right, packet, hits, terminated, primitive_intersector, statistics);
+                    if (primitive_intersector.any_hit && terminated == all_lanes)
+                        break;
+                    right_child = nullptr;
+                }
+            } else
+                right_child = nullptr;
+
+            if (left_child) {
+                if (right_child) {
+                    // Use the order given by the first ray that intersects both children
+                    if (auto both = lanes_left & lanes_right) {
+                        auto lane = first_bit_set(both);
+                        if (entry_left[lane] > entry_right[lane])
+                            std::swap(left_child, right_child);
+                    }
+                    stack.push(right_child->first_child_or_primitive);
+                }
+                left_child = &bvh.nodes[left_child->first_child_or_primitive];
+            } else if (right_child) {
+                left_child = &bvh.nodes[right_child->first_child_or_primitive];
+            } else {
+                if (stack.empty())
+                    break;
+                left_child = &bvh.nodes[stack.pop()];
+            }
+        }
+    }
+
+    const Bvh& bvh;
+
+public:
+    /// Statistics collected during traversal. The number of
+    /// traversal steps is counted per packet, while the number
+    /// of intersections is counted per ray.
+    struct Statistics {
+        size_t traversal_steps = 0;
+        size_t intersections   = 0;
+    };
+
+    PacketTraverser(const Bvh& bvh)
+        : bvh(bvh)
+    {}
+
+    /// Intersects the BVH with a packet of at most `PacketSize` rays.
+    /// The result for the ray at index `i` is written in `hits[i]`.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    void traverse(
+        const Ray<Scalar>* rays, size_t ray_count,
+        std::optional<typename PrimitiveIntersector::Result>* hits,
+        PrimitiveIntersector& intersector) const
+    {
+        struct {
+            struct Empty {
+                Empty& operator ++ (int)    { return *this; }
+                Empty& operator ++ ()       { return *this; }
+                Empty& operator += (size_t) { return *this; }
+            } traversal_steps, intersections;
+        } statistics;
+        for (size_t i = 0; i < ray_count; ++i)
+            hits[i] = std::nullopt;
+        Packet packet(rays, ray_count);
+        intersect(packet, all_lanes >> (PacketSize - ray_count), hits, intersector, statistics);
+    }
+
+    /// Intersects the BVH with a packet of at most `PacketSize` rays.
+    /// Record statistics on the number of traversal and intersection steps.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    void traverse(
+        const Ray<Scalar>* rays, size_t ray_count,
+        std::optional<typename PrimitiveIntersector::Result>* hits,
+        PrimitiveIntersector& intersector,
+        Statistics& statistics) const
+    {
+        for (size_t i = 0; i < ray_count; ++i)
+            hits[i] = std::nullopt;
+        Packet packet(rays, ray_count);
+        intersect(packet, all_lanes >> (PacketSize - ray_count), hits, intersector, statistics);
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -26,6 +26,10 @@ struct PrimitiveIntersector
 
     static constexpr bool any_hit = AnyHit;
 
+    /// Set for intersectors that process whole leaves at once, with an
+    /// `intersect_leaf(begin, end, ray)` method (see `bvh::TriangleBlockIntersector`).
+    static constexpr bool intersects_leaves = false;
+
 protected:
     ~PrimitiveIntersector() {}
 };
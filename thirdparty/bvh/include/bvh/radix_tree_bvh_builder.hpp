@@ -0,0 +1,148 @@
+#ifndef BVH_RADIX_TREE_BVH_BUILDER_HPP
+#define BVH_RADIX_TREE_BVH_BUILDER_HPP
+
+#include <memory>
+#include <cstdint>
+#include <climits>
+#include <cassert>
+#include <algorithm>
+
+#include "bvh/bvh.hpp"
+#include "bvh/morton_code_based_builder.hpp"
+#include "bvh/hierarchy_refitter.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// Fully parallel LBVH builder, based on "Maximizing Parallelism in the Construction of
+/// BVHs, Octrees, and k-d Trees", by T. Karras. Primitives are sorted by Morton code, and
+/// every inner node of the binary radix tree over the sorted codes is computed independently
+/// from the others, in a single parallel pass. Primitives that have the same Morton code are
+/// separated by their index in the sorted array, so that the tree never degenerates.
+/// This builder works with both 32-bit and 64-bit Morton codes. The latter have twice the
+/// resolution on every axis, which matters for dense scenes with many primitives per cell.
+template <typename Bvh, typename Morton>
+class RadixTreeBvhBuilder : public MortonCodeBasedBuilder<Bvh, Morton> {
+    using Scalar = typename Bvh::ScalarType;
+    using Node   = typename Bvh::Node;
+
+    using ParentBuilder = MortonCodeBasedBuilder<Bvh, Morton>;
+    using ParentBuilder::sort_primitives_by_morton_code;
+
+    Bvh& bvh;
+
+    /// Returns the length of the longest common prefix of the keys at index i and j,
+    /// where keys are made of the Morton code followed by the index, or -1 if j is out of bounds.
+    static int common_prefix(const Morton* morton_codes, int64_t count, int64_t i, int64_t j) {
+        if (j < 0 || j >= count)
+            return -1;
+        auto x = morton_codes[i] ^ morton_codes[j];
+        if (x != 0)
+            return int(count_leading_zeros(x));
+        return int(sizeof(Morton) * CHAR_BIT + count_leading_zeros(uint64_t(i ^ j)));
+    }
+
+public:
+    using ParentBuilder::loop_parallel_threshold;
+
+    RadixTreeBvhBuilder(Bvh& bvh)
+        : bvh(bvh)
+    {}
+
+    void build(
+        const BoundingBox<Scalar>& global_bbox,
+        const BoundingBox<Scalar>* bboxes,
+        const Vector3<Scalar>* centers,
+        size_t primitive_count)
+    {
+        assert(primitive_count > 0);
+
+        std::unique_ptr<size_t[]> primitive_indices;
+        std::unique_ptr<Morton[]> morton_codes;
+
+        std::tie(primitive_indices, morton_codes) =
+            sort_primitives_by_morton_code(global_bbox, centers, primitive_count);
+
+        auto node_count = 2 * primitive_count - 1;
+        bvh.nodes = std::make_unique<Node[]>(node_count);
+        bvh.primitive_indices = std::move(primitive_indices);
+        bvh.node_count = node_count;
+
+        if (primitive_count == 1) {
+            auto& root = bvh.nodes[0];
+            root.bounding_box_proxy()     = bboxes[bvh.primitive_indices[0]];
+            root.primitive_count          = 1;
+            root.first_child_or_primitive = 0;
+            return;
+        }
+
+        // The children of inner node i of the radix tree are stored at index 2 * i + 1 and 2 * i + 2.
+        // Since the position of an inner node depends on its parent, it is recorded here first.
+        auto inner_node_indices = std::make_unique<size_t[]>(primitive_count - 1);
+        inner_node_indices[0] = 0;
+
+        auto codes = morton_codes.get();
+        auto count = int64_t(primitive_count);
+
+        #pragma omp parallel if (primitive_count > loop_parallel_threshold)
+        {
+            #pragma omp for
+            for (int64_t i = 0; i < count - 1; ++i) {
+                // Find the direction of the range covered by this node
+                int d = common_prefix(codes, count, i, i + 1) > common_prefix(codes, count, i, i - 1) ? 1 : -1;
+
+                // Find the other end of the range with an exponential search followed by a binary search
+                int min_prefix = common_prefix(codes, count, i, i - d);
+                int64_t max_length = 2;
+                while (common_prefix(codes, count, i, i + max_length * d) > min_prefix)
+                    max_length *= 2;
+                int64_t length = 0;
+                for (auto step = max_length / 2; step > 0; step /= 2) {
+                    if (common_prefix(codes, count, i, i + (length + step) * d) > min_prefix)
+                        length += step;
+                }
+                int64_t j = i + length * d;
+
+                // Find the split position with a binary search
+                int node_prefix = common_prefix(codes, count, i, j);
+                int64_t split = 0;
+                for (int64_t divisor = 2;; divisor *= 2) {
+                    auto step = (length + divisor - 1) / divisor;
+                    if (common_prefix(codes, count, i, i + (split + step) * d) > node_prefix)
+                        split += step;
+                    if (step == 1)
+                        break;
+                }
+                int64_t gamma = i + split * d + std::min(d, 0);
+
+                size_t first_child = 2 * i + 1;
+                int64_t children[] = { gamma, gamma + 1 };
+                bool is_leaf[] = { std::min(i, j) == gamma, std::max(i, j) == gamma + 1 };
+                for (size_t k = 0; k < 2; ++k) {
+                    if (is_leaf[k]) {
+                        auto& leaf = bvh.nodes[first_child + k];
+                        leaf.bounding_box_proxy()     = bboxes[bvh.primitive_indices[children[k]]];
+                        leaf.primitive_count          = 1;
+                        leaf.first_child_or_primitive = children[k];
+                    } else
+                        inner_node_indices[children[k]] = first_child + k;
+                }
+            }
+
+            #pragma omp for
+            for (int64_t i = 0; i < count - 1; ++i) {
+                auto& node = bvh.nodes[inner_node_indices[i]];
+                node.primitive_count          = 0;
+                node.first_child_or_primitive = 2 * i + 1;
+            }
+        }
+
+        // Compute the bounding boxes of the inner nodes
+        HierarchyRefitter<Bvh> refitter(bvh);
+        refitter.refit([] (Node&) {});
+    }
+};
+
+} // namespace bvh
+
+#endif
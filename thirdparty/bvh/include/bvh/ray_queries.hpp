@@ -0,0 +1,168 @@
+#ifndef BVH_RAY_QUERIES_HPP
+#define BVH_RAY_QUERIES_HPP
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+
+#include "bvh/bvh.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/vector.hpp"
+#include "bvh/node_intersectors.hpp"
+#include "bvh/single_ray_traverser.hpp"
+#include "bvh/packet_traverser.hpp"
+#include "bvh/ray_sorter.hpp"
+
+namespace bvh {
+
+/// Batched ray queries: intersects an array of rays with a BVH, using all the available threads.
+/// Rays are processed in groups of `PacketSize` consecutive rays. Groups of coherent rays
+/// (see `Options::coherence_threshold`) are traced with `PacketTraverser`, and the others
+/// are traced one ray at a time with `SingleRayTraverser`. Callers should therefore submit
+/// coherent rays (e.g. the primary rays of neighbouring pixels) next to each other, or
+/// enable `Options::sort_rays` for incoherent rays.
+template <typename Bvh, size_t PacketSize = 8, size_t StackSize = 64>
+class RayQueries
+{
+public:
+    using Scalar = typename Bvh::ScalarType;
+
+    static constexpr size_t packet_size = PacketSize;
+
+    /// Traversal kernel used for a group of rays.
+    enum class Kernel { Automatic, Single, Packet };
+
+    struct Options {
+        /// Kernel used for every group of rays. `Automatic` decides for each group.
+        Kernel kernel = Kernel::Automatic;
+        /// A group of rays is traced as a packet when all its rays are in the same octant, and when
+        /// the cosine of the angle between the first ray and any other ray is above this threshold.
+        Scalar coherence_threshold = Scalar(0.99);
+        /// Number of consecutive rays given to a thread at once.
+        size_t chunk_size = 1024;
+        /// Reorders the rays with `RaySorter` before tracing them. Results are still written in the
+        /// original order. This improves memory locality for large batches of incoherent rays.
+        bool sort_rays = false;
+    };
+
+    RayQueries(const Bvh& bvh)
+        : bvh(bvh)
+    {}
+
+    /// Intersects every ray with the BVH, and writes the result for the ray at index `i` in `hits[i]`.
+    /// Each thread works with its own copy of the primitive intersector.
+    template <typename PrimitiveIntersector>
+    void intersect_rays(
+        const Ray<Scalar>* rays,
+        std::optional<typename PrimitiveIntersector::Result>* hits,
+        size_t ray_count,
+        const PrimitiveIntersector& intersector,
+        const Options& options = Options()) const
+    {
+        process(rays, ray_count, intersector, options,
+            [hits] (size_t i, const std::optional<typename PrimitiveIntersector::Result>& hit) { hits[i] = hit; });
+    }
+
+    /// Tests every ray for occlusion, and writes the result for the ray at index `i` in `occluded[i]`.
+    /// The primitive intersector must be an any-hit intersector (see `AnyPrimitiveIntersector`).
+    template <typename PrimitiveIntersector>
+    void occluded_rays(
+        const Ray<Scalar>* rays,
+        bool* occluded,
+        size_t ray_count,
+        const PrimitiveIntersector& intersector,
+        const Options& options = Options()) const
+    {
+        static_assert(PrimitiveIntersector::any_hit, "Occlusion queries require an any-hit intersector");
+        process(rays, ray_count, intersector, options,
+            [occluded] (size_t i, const std::optional<typename PrimitiveIntersector::Result>& hit) { occluded[i] = hit.has_value(); });
+    }
+
+private:
+    bool is_coherent(const Ray<Scalar>* rays, size_t ray_count, Scalar threshold) const {
+        auto octant = compute_octant(rays[0].direction);
+        auto direction = normalize(rays[0].direction);
+        for (size_t i = 1; i < ray_count; ++i) {
+            if (compute_octant(rays[i].direction) != octant ||
+                dot(direction, rays[i].direction) < threshold * length(rays[i].direction))
+                return false;
+        }
+        return true;
+    }
+
+    bool use_packet(const Ray<Scalar>* rays, size_t ray_count, const Options& options) const {
+        switch (options.kernel) {
+            case Kernel::Single: return false;
+            case Kernel::Packet: return true;
+            default:             return ray_count > 1 && is_coherent(rays, ray_count, options.coherence_threshold);
+        }
+    }
+
+    template <typename PrimitiveIntersector, typename Output>
+    void process(
+        const Ray<Scalar>* rays,
+        size_t ray_count,
+        const PrimitiveIntersector& intersector,
+        const Options& options,
+        Output output) const
+    {
+        if (!options.sort_rays || ray_count <= 1) {
+            trace(rays, ray_count, intersector, options, output);
+            return;
+        }
+
+        // Trace the sorted rays, and scatter the results back to their original positions
+        RaySorter<Scalar> ray_sorter;
+        auto order = ray_sorter.sort(rays, ray_count, bvh.nodes[0].bounding_box_proxy().to_bounding_box());
+        auto sorted_rays = std::make_unique<Ray<Scalar>[]>(ray_count);
+        RaySorter<Scalar>::gather(rays, sorted_rays.get(), order.get(), ray_count);
+        trace(sorted_rays.get(), ray_count, intersector, options,
+            [&output, order = order.get()] (size_t i, const std::optional<typename PrimitiveIntersector::Result>& hit) {
+                output(order[i], hit);
+            });
+    }
+
+    template <typename PrimitiveIntersector, typename Output>
+    void trace(
+        const Ray<Scalar>* rays,
+        size_t ray_count,
+        const PrimitiveIntersector& intersector,
+        const Options& options,
+        Output output) const
+    {
+        SingleRayTraverser<Bvh, StackSize> single_ray_traverser(bvh);
+        PacketTraverser<Bvh, PacketSize, StackSize> packet_traverser(bvh);
+
+        // Chunks are made of whole groups, so that groups never straddle two threads
+        size_t chunk_size = (std::max(options.chunk_size, PacketSize) / PacketSize) * PacketSize;
+
+        #pragma omp parallel
+        {
+            // Per-thread scratch, allocated once for all the chunks processed by this thread
+            PrimitiveIntersector thread_intersector(intersector);
+            std::optional<typename PrimitiveIntersector::Result> packet_hits[PacketSize];
+
+            #pragma omp for schedule(dynamic)
+            for (size_t begin = 0; begin < ray_count; begin += chunk_size) {
+                size_t end = std::min(begin + chunk_size, ray_count);
+                for (size_t i = begin; i < end; i += PacketSize) {
+                    size_t count = std::min(PacketSize, end - i);
+                    if (use_packet(rays + i, count, options)) {
+                        packet_traverser.traverse(rays + i, count, packet_hits, thread_intersector);
+                        for (size_t j = 0; j < count; ++j)
+                            output(i + j, packet_hits[j]);
+                    } else {
+                        for (size_t j = i; j < i + count; ++j)
+                            output(j, single_ray_traverser.traverse(rays[j], thread_intersector));
+                    }
+                }
+            }
+        }
+    }
+
+    const Bvh& bvh;
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef BVH_RAY_SORTER_HPP
+#define BVH_RAY_SORTER_HPP
+
+#include <algorithm>
+#include <memory>
+#include <cassert>
+#include <cstdint>
+
+#include "bvh/bounding_box.hpp"
+#include "bvh/vector.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/morton.hpp"
+#include "bvh/radix_sort.hpp"
+#include "bvh/node_intersectors.hpp"
+
+namespace bvh {
+
+/// Reorders a stream of rays so that rays that are likely to traverse the same parts of
+/// a BVH end up next to each other. The sort key of a ray is made of (from the most to
+/// the least significant bits): its octant, the Morton code of its origin within the
+/// given bounding box, and the Morton code of its normalized direction.
+template <typename Scalar>
+class RaySorter {
+    using Key = uint64_t;
+
+    /// Number of bits processed by every iteration of the radix sort.
+    static constexpr size_t bits_per_iteration = 10;
+
+    RadixSort<bits_per_iteration> radix_sort;
+
+public:
+    /// Maximum number of bits available for the origin and direction, per dimension.
+    static constexpr size_t max_bit_count = (sizeof(Key) * CHAR_BIT - 3) / 3;
+
+    /// Number of bits per dimension used to encode the origin of the rays.
+    size_t origin_bit_count = 8;
+    /// Number of bits per dimension used to encode the direction of the rays.
+    size_t direction_bit_count = 4;
+
+    /// Threshold (number of rays) under which the loops execute serially.
+    size_t loop_parallel_threshold = 256;
+
+    /// Returns the order in which the rays should be traced:
+    /// the ray at index `i` of the sorted stream is `rays[order[i]]`.
+    std::unique_ptr<size_t[]> sort(const Ray<Scalar>* rays, size_t ray_count, const BoundingBox<Scalar>& bbox) {
+        assert(origin_bit_count + direction_bit_count <= max_bit_count);
+        auto keys         = std::make_unique<Key[]>(ray_count);
+        auto keys_copy    = std::make_unique<Key[]>(ray_count);
+        auto indices      = std::make_unique<size_t[]>(ray_count);
+        auto indices_copy = std::make_unique<size_t[]>(ray_count);
+
+        Key*    sorted_keys      = keys.get();
+        size_t* sorted_indices   = indices.get();
+        Key*    unsorted_keys    = keys_copy.get();
+        size_t* unsorted_indices = indices_copy.get();
+
+        MortonEncoder<Key, Scalar> origin_encoder(bbox, size_t(1) << origin_bit_count);
+        MortonEncoder<Key, Scalar> direction_encoder(
+            BoundingBox<Scalar>(Vector3<Scalar>(-1), Vector3<Scalar>(1)),
+            size_t(1) << direction_bit_count);
+        size_t direction_bits = direction_bit_count * 3;
+        size_t octant_shift   = (origin_bit_count + direction_bit_count) * 3;
+
+        #pragma omp parallel if (ray_count > loop_parallel_threshold)
+        {
+            #pragma omp for
+            for (size_t i = 0; i < ray_count; ++i) {
+                keys[i] =
+                    (Key(compute_octant(rays[i].direction)) << octant_shift) |
+                    (origin_encoder.encode(rays[i].origin) << direction_bits) |
+                    direction_encoder.encode(normalize(rays[i].direction));
+                indices[i] = i;
+            }
+
+            radix_sort.sort_in_parallel(
+                sorted_keys,
+                unsorted_keys,
+                sorted_indices,
+                unsorted_indices,
+                ray_count, octant_shift + 3);
+        }
+
+        if (sorted_indices != indices.get())
+            std::swap(indices, indices_copy);
+
+        return indices;
+    }
+
+    /// Copies the elements of `input` into `output`, in the given order: `output[i] = input[order[i]]`.
+    template <typename T>
+    static void gather(const T* input, T* output, const size_t* order, size_t count) {
+        #pragma omp parallel for
+        for (size_t i = 0; i < count; ++i)
+            output[i] = input[order[i]];
+    }
+
+    /// Inverse operation of `gather()`: `output[order[i]] = input[i]`.
+    template <typename T>
+    static void scatter(const T* input, T* output, const size_t* order, size_t count) {
+        #pragma omp parallel for
+        for (size_t i = 0; i < count; ++i)
+            output[order[i]] = input[i];
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef BVH_ROTATING_HIERARCHY_REFITTER_HPP
+#define BVH_ROTATING_HIERARCHY_REFITTER_HPP
+
+#include <memory>
+#include <utility>
+
+#include "bvh/bvh.hpp"
+#include "bvh/bounding_box.hpp"
+#include "bvh/sah_based_algorithm.hpp"
+#include "bvh/bottom_up_algorithm.hpp"
+
+namespace bvh {
+
+/// Refitter for animated scenes, that applies tree rotations during the bottom-up refitting
+/// pass, as described in "Tree Rotations for Improving Bounding Volume Hierarchies", by A. Kensler.
+/// At every inner node, a child can be exchanged with a grandchild on the other side, or two
+/// grandchildren can be exchanged, whenever that reduces the SAH cost. This limits the quality
+/// degradation that a plain refit causes when primitives move. The SAH cost of the BVH is
+/// computed after every refit, so that callers can decide when to rebuild the BVH.
+template <typename Bvh>
+class RotatingHierarchyRefitter :
+    public SahBasedAlgorithm<Bvh>,
+    protected BottomUpAlgorithm<Bvh>
+{
+    using Scalar = typename Bvh::ScalarType;
+
+    using SahBasedAlgorithm<Bvh>::compute_cost;
+    using BottomUpAlgorithm<Bvh>::bvh;
+    using BottomUpAlgorithm<Bvh>::parents;
+    using BottomUpAlgorithm<Bvh>::traverse_in_parallel;
+
+    std::unique_ptr<size_t[]> leaves;
+
+    Scalar initial_cost;
+    Scalar last_cost;
+
+    BoundingBox<Scalar> merge(size_t a, size_t b) const {
+        return bvh.nodes[a].bounding_box_proxy().to_bounding_box().extend(bvh.nodes[b].bounding_box_proxy());
+    }
+
+    Scalar half_area(size_t i) const {
+        return bvh.nodes[i].bounding_box_proxy().half_area();
+    }
+
+    void refit_node(size_t i) {
+        auto first_child = bvh.nodes[i].first_child_or_primitive;
+        bvh.nodes[i].bounding_box_proxy() = merge(first_child, first_child + 1);
+    }
+
+    void swap_nodes(size_t a, size_t b) {
+        std::swap(bvh.nodes[a], bvh.nodes[b]);
+        for (auto i : { a, b }) {
+            auto& node = bvh.nodes[i];
+            if (!node.is_leaf()) {
+                parents[node.first_child_or_primitive + 0] = i;
+                parents[node.first_child_or_primitive + 1] = i;
+            }
+        }
+    }
+
+    /// Applies the rotation that reduces the SAH cost the most below the given node, if any.
+    /// Only the areas of the children of the node change, so the gain is expressed in terms of area.
+    void rotate(size_t i) {
+        auto first_child = bvh.nodes[i].first_child_or_primitive;
+        Scalar best_gain = 0;
+        size_t best_a = 0, best_b = 0, best_refit[2] = { 0, 0 };
+        for (size_t k = 0; k < 2; ++k) {
+            // Exchange a child with a grandchild on the other side
+            auto child = first_child + k;
+            auto other = first_child + 1 - k;
+            if (bvh.nodes[other].is_leaf())
+                continue;
+            auto first_grandchild = bvh.nodes[other].first_child_or_primitive;
+            for (size_t l = 0; l < 2; ++l) {
+                auto grandchild = first_grandchild + l;
+                auto kept       = first_grandchild + 1 - l;
+                auto gain = half_area(other) - merge(child, kept).half_area();
+                if (gain > best_gain) {
+                    best_gain = gain;
+                    best_a = child;
+                    best_b = grandchild;
+                    best_refit[0] = best_refit[1] = other;
+                }
+            }
+        }
+
+        auto left = first_child, right = first_child + 1;
+        if (!bvh.nodes[left].is_leaf() && !bvh.nodes[right].is_leaf()) {
+            // Exchange two grandchildren (exchanging the other two gives the same tree, mirrored)
+            auto first_left  = bvh.nodes[left ].first_child_or_primitive;
+            auto first_right = bvh.nodes[right].first_child_or_primitive;
+            auto area = half_area(left) + half_area(right);
+            for (size_t l = 0; l < 2; ++l) {
+                auto grandchild = first_right + l;
+                auto kept       = first_right + 1 - l;
+                auto gain = area - merge(grandchild, first_left + 1).half_area() - merge(first_left, kept).half_area();
+                if (gain > best_gain) {
+                    best_gain = gain;
+                    best_a = first_left;
+                    best_b = grandchild;
+                    best_refit[0] = left;
+                    best_refit[1] = right;
+                }
+            }
+        }
+
+        if (best_gain <= 0)
+            return;
+        swap_nodes(best_a, best_b);
+        refit_node(best_refit[0]);
+        refit_node(best_refit[1]);
+    }
+
+public:
+    RotatingHierarchyRefitter(Bvh& bvh)
+        : BottomUpAlgorithm<Bvh>(bvh)
+    {
+        leaves = std::make_unique<size_t[]>(bvh.node_count);
+        initial_cost = last_cost = compute_cost(bvh);
+    }
+
+    /// SAH cost of the BVH when the refitter was created.
+    Scalar get_initial_cost() const { return initial_cost; }
+
+    /// SAH cost of the BVH after the last refit.
+    Scalar get_cost() const { return last_cost; }
+
+    /// Refits the BVH after calling `update_leaf` on every leaf, applies rotations,
+    /// and returns the new SAH cost.
+    template <typename UpdateLeaf>
+    Scalar refit(const UpdateLeaf& update_leaf) {
+        // Rotations move leaves, so their positions must be found again every time
+        size_t leaf_count = 0;
+        for (size_t i = 0; i < bvh.node_count; ++i) {
+            if (bvh.nodes[i].is_leaf())
+                leaves[leaf_count++] = i;
+        }
+
+        #pragma omp parallel
+        {
+            traverse_in_parallel(leaves.get(), leaf_count,
+                [&] (size_t i) { update_leaf(bvh.nodes[i]); },
+                [&] (size_t i) {
+                    refit_node(i);
+                    rotate(i);
+                });
+        }
+
+        last_cost = compute_cost(bvh);
+        return last_cost;
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef BVH_SIMD_HPP
+#define BVH_SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#include "bvh/platform.hpp"
+#include "bvh/utilities.hpp"
+
+// The instruction set is selected at compile time, from the flags given to the compiler
+// (e.g. -mavx2 -mfma with GCC/Clang, /arch:AVX2 with MSVC). Packs that do not map to a
+// native register width fall back to a portable implementation that relies on loops.
+#if defined(__AVX__)
+#define BVH_SIMD_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SIMD_SSE2
+#endif
+#if defined(__FMA__)
+#define BVH_SIMD_FMA
+#endif
+
+#if defined(BVH_SIMD_AVX) || defined(BVH_SIMD_SSE2)
+#include <immintrin.h>
+#endif
+
+namespace bvh {
+
+/// Mask resulting from a comparison between two packs.
+template <typename Scalar, size_t N>
+struct PackMask
+{
+    bool values[N];
+
+    bvh_always_inline PackMask operator & (const PackMask& other) const {
+        PackMask mask;
+        for (size_t i = 0; i < N; ++i)
+            mask.values[i] = values[i] && other.values[i];
+        return mask;
+    }
+
+    bvh_always_inline PackMask operator | (const PackMask& other) const {
+        PackMask mask;
+        for (size_t i = 0; i < N; ++i)
+            mask.values[i] = values[i] || other.values[i];
+        return mask;
+    }
+
+    /// Returns a bit mask where bit i is set if lane i is set.
+    bvh_always_inline uint32_t bits() const {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < N; ++i)
+            bits |= uint32_t(values[i]) << i;
+        return bits;
+    }
+};
+
+/// A group of N scalars that are processed together, lane by lane.
+/// This is the portable implementation, which is specialized below
+/// when a native SIMD register of the same width is available.
+template <typename Scalar, size_t N>
+struct Pack
+{
+    using Mask = PackMask<Scalar, N>;
+    static constexpr size_t size = N;
+
+    Scalar values[N];
+
+    Pack() = default;
+    bvh_always_inline explicit Pack(Scalar s) { std::fill(values, values + N, s); }
+
+    bvh_always_inline static Pack load(const Scalar* p) {
+        Pack pack;
+        std::copy(p, p + N, pack.values);
+        return pack;
+    }
+
+    bvh_always_inline void store(Scalar* p) const { std::copy(values, values + N, p); }
+
+    bvh_always_inline Scalar operator [] (size_t i) const { return values[i]; }
+
+    template <typename F>
+    bvh_always_inline static Pack map(F f) {
+        Pack pack;
+        for (size_t i = 0; i < N; ++i)
+            pack.values[i] = f(i);
+        return pack;
+    }
+
+    template <typename F>
+    bvh_always_inline static Mask compare(F f) {
+        Mask mask;
+        for (size_t i = 0; i < N; ++i)
+            mask.values[i] = f(i);
+        return mask;
+    }
+
+    bvh_always_inline Pack operator + (const Pack& b) const { return map([&] (size_t i) { return values[i] + b.values[i]; }); }
+    bvh_always_inline Pack operator - (const Pack& b) const { return map([&] (size_t i) { return values[i] - b.values[i]; }); }
+    bvh_always_inline Pack operator * (const Pack& b) const { return map([&] (size_t i) { return values[i] * b.values[i]; }); }
+    bvh_always_inline Pack operator / (const Pack& b) const { return map([&] (size_t i) { return values[i] / b.values[i]; }); }
+
+    bvh_always_inline Mask operator <  (const Pack& b) const { return compare([&] (size_t i) { return values[i] <  b.values[i]; }); }
+    bvh_always_inline Mask operator <= (const Pack& b) const { return compare([&] (size_t i) { return values[i] <= b.values[i]; }); }
+    bvh_always_inline Mask operator >  (const Pack& b) const { return compare([&] (size_t i) { return values[i] >  b.values[i]; }); }
+    bvh_always_inline Mask operator >= (const Pack& b) const { return compare([&] (size_t i) { return values[i] >= b.values[i]; }); }
+
+    /// Same semantics as `robust_min()`: returns the right hand side for lanes where one operand is a NaN.
+    bvh_always_inline friend Pack min(const Pack& a, const Pack& b) { return map([&] (size_t i) { return robust_min(a.values[i], b.values[i]); }); }
+    /// Same semantics as `robust_max()`: returns the right hand side for lanes where one operand is a NaN.
+    bvh_always_inline friend Pack max(const Pack& a, const Pack& b) { return map([&] (size_t i) { return robust_max(a.values[i], b.values[i]); }); }
+
+    bvh_always_inline friend Pack multiply_add(const Pack& a, const Pack& b, const Pack& c) {
+        return map([&] (size_t i) { return fast_multiply_add(a.values[i], b.values[i], c.values[i]); });
+    }
+
+    /// Returns the lanes of `a` where the mask is set, and the lanes of `b` elsewhere.
+    bvh_always_inline friend Pack select(const Mask& mask, const Pack& a, const Pack& b) {
+        return map([&] (size_t i) { return mask.values[i] ? a.values[i] : b.values[i]; });
+    }
+};
+
+#ifdef BVH_SIMD_SSE2
+template <>
+struct PackMask<float, 4>
+{
+    __m128 m;
+
+    bvh_always_inline PackMask operator & (const PackMask& other) const { return PackMask { _mm_and_ps(m, other.m) }; }
+    bvh_always_inline PackMask operator | (const PackMask& other) const { return PackMask { _mm_or_ps(m, other.m) }; }
+    bvh_always_inline uint32_t bits() const { return uint32_t(_mm_movemask_ps(m)); }
+};
+
+template <>
+struct Pack<float, 4>
+{
+    using Mask = PackMask<float, 4>;
+    static constexpr size_t size = 4;
+
+    __m128 m;
+
+    Pack() = default;
+    bvh_always_inline Pack(__m128 m) : m(m) {}
+    bvh_always_inline explicit Pack(float s) : m(_mm_set1_ps(s)) {}
+
+    bvh_always_inline static Pack load(const float* p) { return Pack(_mm_loadu_ps(p)); }
+    bvh_always_inline void store(float* p) const { _mm_storeu_ps(p, m); }
+
+    bvh_always_inline float operator [] (size_t i) const {
+        alignas(16) float values[4];
+        _mm_store_ps(values, m);
+        return values[i];
+    }
+
+    bvh_always_inline Pack operator + (const Pack& b) const { return _mm_add_ps(m, b.m); }
+    bvh_always_inline Pack operator - (const Pack& b) const { return _mm_sub_ps(m, b.m); }
+    bvh_always_inline Pack operator * (const Pack& b) const { return _mm_mul_ps(m, b.m); }
+    bvh_always_inline Pack operator / (const Pack& b) const { return _mm_div_ps(m, b.m); }
+
+    bvh_always_inline Mask operator <  (const Pack& b) const { return Mask { _mm_cmplt_ps(m, b.m) }; }
+    bvh_always_inline Mask operator <= (const Pack& b) const { return Mask { _mm_cmple_ps(m, b.m) }; }
+    bvh_always_inline Mask operator >  (const Pack& b) const { return Mask { _mm_cmpgt_ps(m, b.m) }; }
+    bvh_always_inline Mask operator >= (const Pack& b) const { return Mask { _mm_cmpge_ps(m, b.m) }; }
+
+    // The SSE min/max instructions return the second operand when one of them is a NaN,
+    // which matches `robust_min()` and `robust_max()`.
+    bvh_always_inline friend Pack min(const Pack& a, const Pack& b) { return _mm_min_ps(a.m, b.m); }
+    bvh_always_inline friend Pack max(const Pack& a, const Pack& b) { return _mm_max_ps(a.m, b.m); }
+
+    bvh_always_inline friend Pack multiply_add(const Pack& a, const Pack& b, const Pack& c) {
+#ifdef BVH_SIMD_FMA
+        return _mm_fmadd_ps(a.m, b.m, c.m);
+#else
+        return _mm_add_ps(_mm_mul_ps(a.m, b.m), c.m);
+#endif
+    }
+
+    bvh_always_inline friend Pack select(const Mask& mask, const Pack& a, const Pack& b) {
+        return _mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m));
+    }
+};
+#endif // BVH_SIMD_SSE2
+
+#ifdef BVH_SIMD_AVX
+template <>
+struct PackMask<float, 8>
+{
+    __m256 m;
+
+    bvh_always_inline PackMask operator & (const PackMask& other) const { return PackMask { _mm256_and_ps(m, other.m) }; }
+    bvh_always_inline PackMask operator | (const PackMask& other) const { return PackMask { _mm256_or_ps(m, other.m) }; }
+    bvh_always_inline uint32_t bits() const { return uint32_t(_mm256_movemask_ps(m)); }
+};
+
+template <>
+struct Pack<float, 8>
+{
+    using Mask = PackMask<float, 8>;
+    static constexpr size_t size = 8;
+
+    __m256 m;
+
+    Pack() = default;
+    bvh_always_inline Pack(__m256 m) : m(m) {}
+    bvh_always_inline explicit Pack(float s) : m(_mm256_set1_ps(s)) {}
+
+    bvh_always_inline static Pack load(const float* p) { return Pack(_mm256_loadu_ps(p)); }
+    bvh_always_inline void store(float* p) const { _mm256_storeu_ps(p, m); }
+
+    bvh_always_inline float operator [] (size_t i) const {
+        alignas(32) float values[8];
+        _mm256_store_ps(values, m);
+        return values[i];
+    }
+
+    bvh_always_inline Pack operator + (const Pack& b) const { return _mm256_add_ps(m, b.m); }
+    bvh_always_inline Pack operator - (const Pack& b) const { return _mm256_sub_ps(m, b.m); }
+    bvh_always_inline Pack operator * (const Pack& b) const { return _mm256_mul_ps(m, b.m); }
+    bvh_always_inline Pack operator / (const Pack& b) const { return _mm256_div_ps(m, b.m); }
+
+    bvh_always_inline Mask operator <  (const Pack& b) const { return Mask { _mm256_cmp_ps(m, b.m, _CMP_LT_OQ) }; }
+    bvh_always_inline Mask operator <= (const Pack& b) const { return Mask { _mm256_cmp_ps(m, b.m, _CMP_LE_OQ) }; }
+    bvh_always_inline Mask operator >  (const Pack& b) const { return Mask { _mm256_cmp_ps(m, b.m, _CMP_GT_OQ) }; }
+    bvh_always_inline Mask operator >= (const Pack& b) const { return Mask { _mm256_cmp_ps(m, b.m, _CMP_GE_OQ) }; }
+
+    bvh_always_inline friend Pack min(const Pack& a, const Pack& b) { return _mm256_min_ps(a.m, b.m); }
+    bvh_always_inline friend Pack max(const Pack& a, const Pack& b) { return _mm256_max_ps(a.m, b.m); }
+
+    bvh_always_inline friend Pack multiply_add(const Pack& a, const Pack& b, const Pack& c) {
+#ifdef BVH_SIMD_FMA
+        return _mm256_fmadd_ps(a.m, b.m, c.m);
+#else
+        return _mm256_add_ps(_mm256_mul_ps(a.m, b.m), c.m);
+#endif
+    }
+
+    bvh_always_inline friend Pack select(const Mask& mask, const Pack& a, const Pack& b) {
+        return _mm256_blendv_ps(b.m, a.m, mask.m);
+    }
+};
+#endif // BVH_SIMD_AVX
+
+/// Returns the index of the least significant bit set in the given (non-zero) mask.
+inline size_t first_bit_set(uint32_t bits) {
+    assert(bits != 0);
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(bits);
+#else
+    size_t i = 0;
+    while (!(bits & 1)) { bits >>= 1; i++; }
+    return i;
+#endif
+}
+
+} // namespace bvh
+
+#endif
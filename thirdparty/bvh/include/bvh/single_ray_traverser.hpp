@@ -52,15 +52,22 @@ private:
         size_t begin = node.first_child_or_primitive;
         size_t end   = begin + node.primitive_count;
         statistics.intersections += end - begin;
-        for (size_t i = begin; i < end; ++i)
-        {
-            if (auto hit = primitive_intersector.intersect(i, ray))
-            {
+        if constexpr (PrimitiveIntersector::intersects_leaves) {
+            if (auto hit = primitive_intersector.intersect_leaf(begin, end, ray)) {
                 best_hit = hit;
-                if (primitive_intersector.any_hit)
-                    return best_hit;
                 ray.tmax = hit->distance();
             }
+        } else {
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (auto hit = primitive_intersector.intersect(i, ray))
+                {
+                    best_hit = hit;
+                    if (primitive_intersector.any_hit)
+                        return best_hit;
+                    ray.tmax = hit->distance();
+                }
+            }
         }
         return best_hit;
     }
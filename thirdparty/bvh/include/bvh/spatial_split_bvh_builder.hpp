@@ -9,6 +9,7 @@
 #include "bvh/bounding_box.hpp"
 #include "bvh/top_down_builder.hpp"
 #include "bvh/sah_based_algorithm.hpp"
+#include "bvh/bin_schedule.hpp"
 
 namespace bvh {
 
@@ -19,13 +20,14 @@ template <typename, typename, size_t> class SpatialSplitBvhBuildTask;
 /// Even though the object splitting strategy is a full-sweep SAH evaluation,
 /// this builder is not as efficient as bvh::SweepSahBuilder when spatial splits
 /// are disabled, because it needs to sort primitive references at every step.
+/// The template parameter `BinCount` is the largest number of bins used to find spatial splits.
 template <typename Bvh, typename Primitive, size_t BinCount>
 class SpatialSplitBvhBuilder : public TopDownBuilder, public SahBasedAlgorithm<Bvh> {
     using Scalar    = typename Bvh::ScalarType;
     using BuildTask = SpatialSplitBvhBuildTask<Bvh, Primitive, BinCount>;
     using Reference = typename BuildTask::ReferenceType;
 
-    using TopDownBuilder::run_task;
+    using TopDownBuilder::run_first_task;
 
     friend BuildTask;
 
@@ -41,6 +43,10 @@ public:
     /// increasing the number of bins.
     size_t binning_pass_count = 2;
 
+    /// Number of spatial split bins used for the nodes at every depth. Bin counts are clamped
+    /// to the range [2, BinCount], and depths that are not covered by the schedule use `BinCount` bins.
+    BinSchedule bin_schedule;
+
     SpatialSplitBvhBuilder(Bvh& bvh)
         : bvh(bvh)
     {}
@@ -77,31 +83,25 @@ public:
         bvh.node_count = 1;
         bvh.nodes[0].bounding_box_proxy() = global_bbox;
 
-        #pragma omp parallel
-        {
-            #pragma omp for
-            for (size_t i = 0; i < primitive_count; ++i) {
-                for (int j = 0; j < 3; ++j) {
-                    references[j][i].bbox   = bboxes[i];
-                    references[j][i].center = centers[i];
-                    references[j][i].primitive_index = i;
-                }
-            }
-
-            #pragma omp single
-            {
-                BuildTask first_task(
-                    *this,
-                    primitives,
-                    accumulated_bboxes.get(),
-                    references,
-                    reference_count,
-                    primitive_count,
-                    spatial_threshold);
-                run_task(first_task, 0, 0, primitive_count, max_reference_count, 0, false);
+        #pragma omp parallel for
+        for (size_t i = 0; i < primitive_count; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                references[j][i].bbox   = bboxes[i];
+                references[j][i].center = centers[i];
+                references[j][i].primitive_index = i;
             }
         }
 
+        BuildTask first_task(
+            *this,
+            primitives,
+            accumulated_bboxes.get(),
+            references,
+            reference_count,
+            primitive_count,
+            spatial_threshold);
+        run_first_task(first_task, 0, 0, primitive_count, max_reference_count, 0, false);
+
         return reference_count;
     }
 };
@@ -185,18 +185,20 @@ class SpatialSplitBvhBuildTask : public TopDownBuildTask {
     size_t  primitive_count;
     Scalar  spatial_threshold;
 
-    static constexpr size_t bin_count = BinCount;
-    std::array<Bin, bin_count> bins;
+    static constexpr size_t max_bin_count = BinCount;
+    std::array<Bin, max_bin_count> bins;
+
+    /// Number of bins used for the node that is being built.
+    size_t bin_count = max_bin_count;
 
     ObjectSplit find_object_split(size_t begin, size_t end, bool is_sorted) const {
         if (!is_sorted) {
             // Sort references by the projection of their centers on this axis
-            #pragma omp taskloop if (end - begin > builder.task_spawn_threshold) grainsize(1) default(shared)
-            for (int axis = 0; axis < 3; ++axis) {
+            builder.parallel_for(3, [&] (size_t axis) {
                 std::sort(references[axis] + begin, references[axis] + end, [&] (const Reference& a, const Reference& b) {
                     return a.center[axis] < b.center[axis];
                 });
-            }
+            }, end - begin > builder.task_spawn_threshold);
         }
 
         ObjectSplit best_split;
@@ -231,9 +233,7 @@ class SpatialSplitBvhBuildTask : public TopDownBuildTask {
         auto& parent = bvh.nodes[item.node_index];
 
         // Allocate two nodes for the children
-        size_t first_child;
-        #pragma omp atomic capture
-        { first_child = bvh.node_count; bvh.node_count += 2; }
+        size_t first_child = atomic_fetch_add(bvh.node_count, 2);
 
         auto& left  = bvh.nodes[first_child + 0];
         auto& right = bvh.nodes[first_child + 1];
@@ -504,9 +504,7 @@ public:
             size_t primitive_count = end - begin;
 
             // Reserve space for the primitives
-            size_t first_primitive;
-            #pragma omp atomic capture
-            { first_primitive = reference_count; reference_count += primitive_count; }
+            size_t first_primitive = atomic_fetch_add(reference_count, primitive_count);
 
             // Copy the primitives indices from the references to the BVH
             for (size_t i = 0; i < primitive_count; ++i)
@@ -527,6 +525,7 @@ public:
         auto overlap = BoundingBox<Scalar>(best_object_split.left_bbox).shrink(best_object_split.right_bbox).half_area();
         if (overlap > spatial_threshold && item.split_end - item.end > 0) {
             auto binning_pass_count = static_cast<SpatialSplitBvhBuilder<Bvh, Primitive, BinCount>&>(builder).binning_pass_count;
+            bin_count = std::clamp(builder.bin_schedule.bin_count(item.depth, max_bin_count), size_t(2), max_bin_count);
             best_spatial_split = find_spatial_split(node.bounding_box_proxy(), item.begin, item.end, binning_pass_count);
         }
 
@@ -0,0 +1,205 @@
+#ifndef BVH_STACKLESS_TRAVERSER_HPP
+#define BVH_STACKLESS_TRAVERSER_HPP
+
+#include <cassert>
+#include <cmath>
+#include <optional>
+
+#include "bvh/bvh.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/node_intersectors.hpp"
+#include "bvh/bottom_up_algorithm.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// Computes the parent of every node of a BVH, in the compact form used by `StacklessTraverser`.
+/// The parent of the root is the root itself.
+template <typename Bvh>
+class ParentLinkBuilder : public BottomUpAlgorithm<Bvh> {
+    using BottomUpAlgorithm<Bvh>::parents;
+    using BottomUpAlgorithm<Bvh>::bvh;
+
+public:
+    ParentLinkBuilder(Bvh& bvh)
+        : BottomUpAlgorithm<Bvh>(bvh)
+    {}
+
+    std::unique_ptr<typename Bvh::IndexType[]> build() {
+        auto parent_links = std::make_unique<typename Bvh::IndexType[]>(bvh.node_count);
+        #pragma omp parallel for
+        for (size_t i = 0; i < bvh.node_count; ++i)
+            parent_links[i] = parents[i];
+        return parent_links;
+    }
+};
+
+/// Single ray traversal algorithm that does not need a stack, using the state machine
+/// described in "Efficient Stack-less BVH Traversal for Ray Tracing", by M. Hapala et al.
+/// Nodes are reached either from their parent, from their sibling, or from one of their
+/// children, and the parent links (see `ParentLinkBuilder`) are used to go back up the tree.
+/// The children of a node are visited in an order that only depends on the ray direction,
+/// so that the state machine can decide where to go next when coming back from a child.
+template <typename Bvh, typename NodeIntersector = FastNodeIntersector<Bvh>>
+class StacklessTraverser
+{
+    using Scalar    = typename Bvh::ScalarType;
+    using IndexType = typename Bvh::IndexType;
+
+    enum class State { FromParent, FromSibling, FromChild };
+
+    /// Returns the index of the child that is visited first.
+    bvh_always_inline
+    size_t near_child(const typename Bvh::Node& node, const Ray<Scalar>& ray) const {
+        assert(!node.is_leaf());
+        auto first_child = node.first_child_or_primitive;
+        const auto& left  = bvh.nodes[first_child + 0];
+        const auto& right = bvh.nodes[first_child + 1];
+
+        // Use the axis along which the children are the most separated
+        int axis = 0;
+        Scalar max_distance = -1;
+        for (int i = 0; i < 3; ++i) {
+            auto distance = std::fabs(
+                (right.bounds[i * 2] + right.bounds[i * 2 + 1]) -
+                (left .bounds[i * 2] + left .bounds[i * 2 + 1]));
+            if (distance > max_distance) {
+                max_distance = distance;
+                axis = i;
+            }
+        }
+        bool left_first = (left.bounds[axis * 2] + left.bounds[axis * 2 + 1]) <= (right.bounds[axis * 2] + right.bounds[axis * 2 + 1]);
+        return first_child + (left_first == std::signbit(ray.direction[axis]) ? 1 : 0);
+    }
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    bool intersect_leaf(
+        const typename Bvh::Node& node,
+        Ray<Scalar>& ray,
+        std::optional<typename PrimitiveIntersector::Result>& best_hit,
+        PrimitiveIntersector& primitive_intersector,
+        Statistics& statistics) const
+    {
+        assert(node.is_leaf());
+        size_t begin = node.first_child_or_primitive;
+        size_t end   = begin + node.primitive_count;
+        statistics.intersections += end - begin;
+        if constexpr (PrimitiveIntersector::intersects_leaves) {
+            if (auto hit = primitive_intersector.intersect_leaf(begin, end, ray)) {
+                best_hit = hit;
+                if (primitive_intersector.any_hit)
+                    return true;
+                ray.tmax = hit->distance();
+            }
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                if (auto hit = primitive_intersector.intersect(i, ray)) {
+                    best_hit = hit;
+                    if (primitive_intersector.any_hit)
+                        return true;
+                    ray.tmax = hit->distance();
+                }
+            }
+        }
+        return false;
+    }
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    intersect(Ray<Scalar> ray, PrimitiveIntersector& primitive_intersector, Statistics& statistics) const
+    {
+        auto best_hit = std::optional<typename PrimitiveIntersector::Result>(std::nullopt);
+
+        // If the root is a leaf, intersect it and return
+        if (bvh_unlikely(bvh.nodes[0].is_leaf())) {
+            intersect_leaf(bvh.nodes[0], ray, best_hit, primitive_intersector, statistics);
+            return best_hit;
+        }
+
+        NodeIntersector node_intersector(ray);
+
+        size_t current = near_child(bvh.nodes[0], ray);
+        auto state = State::FromParent;
+        while (true) {
+            if (state == State::FromChild) {
+                if (current == 0)
+                    break;
+                auto parent = parent_links[current];
+                if (current == near_child(bvh.nodes[parent], ray)) {
+                    current = Bvh::sibling(current);
+                    state = State::FromSibling;
+                } else
+                    current = parent;
+                continue;
+            }
+
+            // The node has been reached from its parent or its sibling
+            statistics.traversal_steps++;
+            const auto& node = bvh.nodes[current];
+            auto distance = node_intersector.intersect(node, ray);
+            if (distance.first <= distance.second && !node.is_leaf()) {
+                current = near_child(node, ray);
+                state = State::FromParent;
+                continue;
+            }
+            if (distance.first <= distance.second &&
+                intersect_leaf(node, ray, best_hit, primitive_intersector, statistics))
+                break;
+            if (state == State::FromParent) {
+                current = Bvh::sibling(current);
+                state = State::FromSibling;
+            } else {
+                current = parent_links[current];
+                state = State::FromChild;
+            }
+        }
+
+        return best_hit;
+    }
+
+    const Bvh& bvh;
+    const IndexType* parent_links;
+
+public:
+    /// Statistics collected during traversal. Every ray-node test counts as a traversal step.
+    struct Statistics {
+        size_t traversal_steps = 0;
+        size_t intersections   = 0;
+    };
+
+    StacklessTraverser(const Bvh& bvh, const IndexType* parent_links)
+        : bvh(bvh), parent_links(parent_links)
+    {}
+
+    /// Intersects the BVH with the given ray and intersector.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& intersector) const
+    {
+        struct {
+            struct Empty {
+                Empty& operator ++ (int)    { return *this; }
+                Empty& operator ++ ()       { return *this; }
+                Empty& operator += (size_t) { return *this; }
+            } traversal_steps, intersections;
+        } statistics;
+        return intersect(ray, intersector, statistics);
+    }
+
+    /// Intersects the BVH with the given ray and intersector.
+    /// Record statistics on the number of traversal and intersection steps.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& primitive_intersector, Statistics& statistics) const
+    {
+        return intersect(ray, primitive_intersector, statistics);
+    }
+};
+
+} // namespace bvh
+
+#endif
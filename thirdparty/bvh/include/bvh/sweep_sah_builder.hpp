@@ -24,7 +24,7 @@ class SweepSahBuilder : public TopDownBuilder, public SahBasedAlgorithm<Bvh> {
     using Key       = typename SizedIntegerType<sizeof(Scalar) * CHAR_BIT>::Unsigned;
     using Mark      = typename BuildTask::MarkType;
 
-    using TopDownBuilder::run_task;
+    using TopDownBuilder::run_first_task;
 
     friend BuildTask;
 
@@ -101,13 +101,10 @@ public:
                     primitive_count,
                     sizeof(Scalar) * CHAR_BIT);
             }
-
-            #pragma omp single
-            {
-                BuildTask first_task(*this, bboxes, centers, sorted_references, costs, mark_data.get());
-                run_task(first_task, 0, 0, primitive_count, 0);
-            }
         }
+
+        BuildTask first_task(*this, bboxes, centers, sorted_references, costs, mark_data.get());
+        run_first_task(first_task, 0, 0, primitive_count, 0);
     }
 };
 
@@ -178,12 +175,12 @@ public:
         }
 
         std::pair<Scalar, size_t> best_splits[3];
-        [[maybe_unused]] bool should_spawn_tasks = item.work_size() > builder.task_spawn_threshold;
+        bool should_spawn_tasks = item.work_size() > builder.task_spawn_threshold;
 
         // Sweep primitives to find the best cost
-        #pragma omp taskloop if (should_spawn_tasks) grainsize(1) default(shared)
-        for (int axis = 0; axis < 3; ++axis)
-            best_splits[axis] = find_split(axis, item.begin, item.end);
+        builder.parallel_for(3, [&] (size_t axis) {
+            best_splits[axis] = find_split(int(axis), item.begin, item.end);
+        }, should_spawn_tasks);
 
         int best_axis = 0;
         if (best_splits[0].first > best_splits[1].first)
@@ -235,9 +232,7 @@ public:
         }
 
         // Allocate space for children
-        size_t first_child;
-        #pragma omp atomic capture
-        { first_child = bvh.node_count; bvh.node_count += 2; }
+        size_t first_child = atomic_fetch_add(bvh.node_count, 2);
 
         auto& left  = bvh.nodes[first_child + 0];
         auto& right = bvh.nodes[first_child + 1];
@@ -2,8 +2,13 @@
 #define BVH_TOP_DOWN_BUILDER_HPP
 
 #include <stack>
+#include <vector>
+#include <algorithm>
 #include <cassert>
 
+#include "bvh/work_stealing_executor.hpp"
+#include "bvh/platform.hpp"
+
 namespace bvh {
 
 /// Base class for top-down build tasks.
@@ -43,9 +48,116 @@ public:
     /// to avoid creating leaves that are larger than this threshold.
     size_t max_leaf_size = 16;
 
+    /// Executor used to build independent subtrees in parallel.
+    /// When null (the default), subtrees are built with OpenMP tasks.
+    WorkStealingExecutor* executor = nullptr;
+
 protected:
     ~TopDownBuilder() {}
 
+    /// Number of threads that can work on a single node: every worker of the executor
+    /// for the top levels of the tree (see `run_task_on_executor()`), and only the current
+    /// worker below them, or the threads of the current OpenMP team.
+    size_t node_thread_count() const
+    {
+        if (executor)
+            return executor->is_running() ? 1 : executor->get_thread_count();
+        return bvh::get_thread_count();
+    }
+
+    /// Calls `f(i)` for every `i` in [0, `count`[, in parallel when `parallel` is true, with the
+    /// executor when there is one, or with OpenMP tasks otherwise. Used by build tasks to split
+    /// the work on a single node.
+    template <typename F>
+    void parallel_for(size_t count, F&& f, [[maybe_unused]] bool parallel = true) const
+    {
+        if (executor && parallel)
+        {
+            executor->parallel_for(count, f);
+            return;
+        }
+
+        #pragma omp taskloop if (parallel) grainsize(1) default(shared)
+        for (size_t i = 0; i < count; ++i)
+            f(i);
+    }
+
+    /// Builds the tree from a work item constructed with the given arguments, using either
+    /// OpenMP tasks or the executor. Must be called outside of any OpenMP parallel region.
+    template <typename BuildTask, typename... Args>
+    void run_first_task(BuildTask& task, Args&&... args)
+    {
+        using WorkItem = typename BuildTask::WorkItemType;
+        if (executor)
+        {
+            run_task_on_executor(task, WorkItem(std::forward<Args&&>(args)...));
+            return;
+        }
+
+        #pragma omp parallel
+        #pragma omp single
+        run_task(task, std::forward<Args&&>(args)...);
+    }
+
+    template <typename BuildTask>
+    void run_task_on_executor(const BuildTask& task, const typename BuildTask::WorkItemType& first_item)
+    {
+        using WorkItem = typename BuildTask::WorkItemType;
+
+        // The top levels of the tree are built one node at a time by the calling thread, which can
+        // use every worker on a single node with `parallel_for()`, until there are enough subtrees
+        // to keep the workers busy.
+        BuildTask top_task(task);
+        std::vector<WorkItem> items(1, first_item);
+        while (items.size() < executor->get_thread_count())
+        {
+            auto largest = std::max_element(items.begin(), items.end(),
+                [] (const WorkItem& a, const WorkItem& b) { return a.work_size() < b.work_size(); });
+            if (largest->work_size() <= task_spawn_threshold)
+                break;
+            auto work_item = *largest;
+            assert(work_item.depth <= max_depth);
+            items.erase(largest);
+
+            if (auto more_work = top_task.build(work_item))
+            {
+                items.push_back(more_work->first);
+                items.push_back(more_work->second);
+            }
+            if (items.empty())
+                return;
+        }
+
+        // Every worker has its own copy of the task, which holds the scratch data of the builder.
+        // Only work items are exchanged between workers.
+        std::vector<BuildTask> tasks(executor->get_thread_count(), task);
+        executor->run(items, [&] (size_t worker_index, const WorkItem& item, auto& spawn)
+        {
+            auto& worker_task = tasks[worker_index];
+            std::stack<WorkItem> stack;
+            stack.push(item);
+            while (!stack.empty())
+            {
+                auto work_item = stack.top();
+                assert(work_item.depth <= max_depth);
+                stack.pop();
+
+                auto more_work = worker_task.build(work_item);
+                if (more_work)
+                {
+                    if (more_work->first.work_size() > more_work->second.work_size())
+                        std::swap(more_work->first, more_work->second);
+
+                    stack.push(more_work->second);
+                    if (more_work->first.work_size() > task_spawn_threshold)
+                        spawn(more_work->first);
+                    else
+                        stack.push(more_work->first);
+                }
+            }
+        });
+    }
+
     template <typename BuildTask, typename... Args>
     void run_task(BuildTask& task, Args&&... args)
     {
@@ -0,0 +1,58 @@
+#ifndef BVH_TRANSFORMED_TRAVERSER_HPP
+#define BVH_TRANSFORMED_TRAVERSER_HPP
+
+#include <optional>
+
+#include "bvh/bvh.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/affine_transform.hpp"
+#include "bvh/single_ray_traverser.hpp"
+
+namespace bvh {
+
+/// Adapter that intersects a BVH built in object space with rays given in world space, for a mesh
+/// that is placed in the scene with an affine transform. Rays are transformed into object space
+/// before being given to the underlying traverser, so that moving the mesh does not require
+/// rebuilding or refitting its BVH. Since transformed directions are not normalized, distances
+/// (and barycentric coordinates) are the same in both spaces: only normals need to be transformed
+/// back to world space, with `normal_to_world()`.
+template <typename Bvh, typename Traverser = SingleRayTraverser<Bvh>>
+class TransformedTraverser {
+    using Scalar = typename Bvh::ScalarType;
+
+    Traverser traverser;
+    AffineTransform<Scalar> world_to_object;
+
+public:
+    using Statistics = typename Traverser::Statistics;
+
+    TransformedTraverser(const Traverser& traverser, const AffineTransform<Scalar>& object_to_world)
+        : traverser(traverser), world_to_object(object_to_world.inverse())
+    {}
+
+    /// Transforms a normal of the mesh into world space.
+    Vector3<Scalar> normal_to_world(const Vector3<Scalar>& normal) const {
+        return world_to_object.transform_normal(normal);
+    }
+
+    /// Intersects the BVH with the given ray and intersector.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& intersector) const {
+        return traverser.traverse(world_to_object.transform_ray(ray), intersector);
+    }
+
+    /// Intersects the BVH with the given ray and intersector.
+    /// Record statistics on the number of traversal and intersection steps.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& intersector, Statistics& statistics) const {
+        return traverser.traverse(world_to_object.transform_ray(ray), intersector, statistics);
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef BVH_TREELET_RESTRUCTURING_OPTIMIZER_HPP
+#define BVH_TREELET_RESTRUCTURING_OPTIMIZER_HPP
+
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+#include "bvh/bvh.hpp"
+#include "bvh/bounding_box.hpp"
+#include "bvh/sah_based_algorithm.hpp"
+#include "bvh/bottom_up_algorithm.hpp"
+
+namespace bvh {
+
+/// Optimization that restructures small treelets of the BVH so as to minimize their SAH cost,
+/// as described in "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies",
+/// by T. Karras and T. Aila. Treelets are formed bottom-up, in parallel, by expanding the
+/// largest leaf of the treelet until it has the requested number of leaves. The optimal
+/// topology of each treelet is then found by dynamic programming over all subsets of its leaves.
+/// This is mostly useful to improve the quality of BVHs built with fast, low-quality builders.
+template <typename Bvh>
+class TreeletRestructuringOptimizer :
+    public SahBasedAlgorithm<Bvh>,
+    protected BottomUpAlgorithm<Bvh>
+{
+    using Scalar = typename Bvh::ScalarType;
+    using Node   = typename Bvh::Node;
+
+    using SahBasedAlgorithm<Bvh>::traversal_cost;
+    using BottomUpAlgorithm<Bvh>::bvh;
+    using BottomUpAlgorithm<Bvh>::parents;
+    using BottomUpAlgorithm<Bvh>::traverse_in_parallel;
+
+    static constexpr size_t max_treelet_leaf_count = 8;
+
+    /// SAH cost of the subtree rooted at each node (not divided by the area of the root).
+    std::unique_ptr<Scalar[]> costs;
+
+    /// Number of primitives in the subtree rooted at each node. Only valid for
+    /// the nodes that have not been moved since they have been processed.
+    std::unique_ptr<size_t[]> primitive_counts;
+
+public:
+    /// Number of leaves of each treelet. The cost of the optimization grows
+    /// with 3^n, and the paper recommends 7 as a good trade-off.
+    size_t treelet_leaf_count = 7;
+
+    TreeletRestructuringOptimizer(Bvh& bvh)
+        : BottomUpAlgorithm<Bvh>(bvh)
+    {}
+
+private:
+    void restructure(size_t root) {
+        size_t leaf_count = std::clamp(treelet_leaf_count, size_t(2), max_treelet_leaf_count);
+        size_t leaves[max_treelet_leaf_count];
+        size_t pairs[max_treelet_leaf_count - 1];
+
+        // Form the treelet by expanding the leaf with the largest area
+        auto first_child = bvh.nodes[root].first_child_or_primitive;
+        leaves[0] = first_child + 0;
+        leaves[1] = first_child + 1;
+        pairs[0]  = first_child;
+        size_t treelet_size = 2, pair_count = 1;
+        while (treelet_size < leaf_count) {
+            size_t best_leaf = treelet_size;
+            Scalar best_area = -std::numeric_limits<Scalar>::max();
+            for (size_t i = 0; i < treelet_size; ++i) {
+                auto& node = bvh.nodes[leaves[i]];
+                if (node.is_leaf())
+                    continue;
+                auto area = node.bounding_box_proxy().half_area();
+                if (area > best_area) {
+                    best_area = area;
+                    best_leaf = i;
+                }
+            }
+            if (best_leaf == treelet_size)
+                break;
+            auto first_grandchild = bvh.nodes[leaves[best_leaf]].first_child_or_primitive;
+            pairs[pair_count++]    = first_grandchild;
+            leaves[best_leaf]      = first_grandchild + 0;
+            leaves[treelet_size++] = first_grandchild + 1;
+        }
+
+        // Treelets of two leaves only have one possible topology
+        if (treelet_size < 3)
+            return;
+
+        // Compute the optimal cost of every subset of leaves, from the smallest subsets to the
+        // largest ones (every proper subset of a set has a smaller index than the set itself).
+        size_t subset_count = size_t(1) << treelet_size;
+        BoundingBox<Scalar> bboxes[size_t(1) << max_treelet_leaf_count];
+        Scalar subset_costs[size_t(1) << max_treelet_leaf_count];
+        uint8_t partitions[size_t(1) << max_treelet_leaf_count];
+        for (size_t i = 0; i < treelet_size; ++i) {
+            bboxes[size_t(1) << i]       = bvh.nodes[leaves[i]].bounding_box_proxy().to_bounding_box();
+            subset_costs[size_t(1) << i] = costs[leaves[i]];
+        }
+        for (size_t s = 1; s < subset_count; ++s) {
+            if ((s & (s - 1)) == 0)
+                continue;
+            auto lowest = s & (~s + 1);
+            bboxes[s] = bboxes[s ^ lowest];
+            bboxes[s].extend(bboxes[lowest]);
+
+            // Partitions are symmetric: only consider those where the first part contains the lowest leaf
+            auto best_cost = std::numeric_limits<Scalar>::max();
+            size_t best_partition = lowest;
+            auto others = s ^ lowest;
+            for (size_t q = (others - 1) & others;; q = (q - 1) & others) {
+                auto p = q | lowest;
+                auto cost = subset_costs[p] + subset_costs[s ^ p];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_partition = p;
+                }
+                if (q == 0)
+                    break;
+            }
+            subset_costs[s] = traversal_cost * bboxes[s].half_area() + best_cost;
+            partitions[s]   = static_cast<uint8_t>(best_partition);
+        }
+
+        auto all_leaves = subset_count - 1;
+        if (!(subset_costs[all_leaves] < costs[root]))
+            return;
+
+        // Save the leaves of the treelet, since their slots may be reused for other nodes
+        Node leaf_nodes[max_treelet_leaf_count];
+        Scalar leaf_costs[max_treelet_leaf_count];
+        for (size_t i = 0; i < treelet_size; ++i) {
+            leaf_nodes[i] = bvh.nodes[leaves[i]];
+            leaf_costs[i] = costs[leaves[i]];
+        }
+
+        // Rebuild the treelet with the optimal topology, reusing the pairs of nodes of the old one
+        struct Item { size_t node_index, subset; };
+        Item stack[max_treelet_leaf_count];
+        size_t stack_size = 0, next_pair = 0;
+        stack[stack_size++] = Item { root, all_leaves };
+        while (stack_size > 0) {
+            auto item = stack[--stack_size];
+            auto& node = bvh.nodes[item.node_index];
+            if ((item.subset & (item.subset - 1)) == 0) {
+                size_t i = 0;
+                while ((item.subset >> i) != 1) i++;
+                node = leaf_nodes[i];
+                costs[item.node_index] = leaf_costs[i];
+                if (!node.is_leaf()) {
+                    parents[node.first_child_or_primitive + 0] = item.node_index;
+                    parents[node.first_child_or_primitive + 1] = item.node_index;
+                }
+                continue;
+            }
+
+            auto pair = pairs[next_pair++];
+            node.bounding_box_proxy()     = bboxes[item.subset];
+            node.primitive_count          = 0;
+            node.first_child_or_primitive = pair;
+            costs[item.node_index] = subset_costs[item.subset];
+            parents[pair + 0] = item.node_index;
+            parents[pair + 1] = item.node_index;
+            auto partition = partitions[item.subset];
+            stack[stack_size++] = Item { pair + 0, partition };
+            stack[stack_size++] = Item { pair + 1, item.subset ^ partition };
+        }
+        assert(next_pair == pair_count);
+    }
+
+public:
+    /// Runs the given number of restructuring passes over the BVH. Following the paper, only
+    /// the nodes that contain at least as many primitives as there are leaves in a treelet
+    /// are restructured, and that threshold is doubled after every pass, since the largest
+    /// improvements are obtained during the first pass.
+    void optimize(size_t iteration_count = 3) {
+        costs            = std::make_unique<Scalar[]>(bvh.node_count);
+        primitive_counts = std::make_unique<size_t[]>(bvh.node_count);
+        auto leaves = std::make_unique<size_t[]>(bvh.node_count);
+
+        size_t min_primitive_count = treelet_leaf_count;
+        for (size_t iteration = 0; iteration < iteration_count; ++iteration, min_primitive_count *= 2) {
+            // Leaves move during the restructuring, so their positions must be found again every time
+            size_t leaf_count = 0;
+            for (size_t i = 0; i < bvh.node_count; ++i) {
+                if (bvh.nodes[i].is_leaf())
+                    leaves[leaf_count++] = i;
+            }
+
+            #pragma omp parallel
+            {
+                traverse_in_parallel(leaves.get(), leaf_count,
+                    [&] (size_t i) {
+                        auto& leaf = bvh.nodes[i];
+                        costs[i] = leaf.bounding_box_proxy().half_area() * leaf.primitive_count;
+                        primitive_counts[i] = leaf.primitive_count;
+                    },
+                    [&] (size_t i) {
+                        // The children of this node have already been restructured
+                        auto& node = bvh.nodes[i];
+                        auto first_child = node.first_child_or_primitive;
+                        costs[i] =
+                            traversal_cost * node.bounding_box_proxy().half_area() +
+                            costs[first_child + 0] + costs[first_child + 1];
+                        primitive_counts[i] = primitive_counts[first_child + 0] + primitive_counts[first_child + 1];
+                        if (primitive_counts[i] >= min_primitive_count)
+                            restructure(i);
+                    });
+            }
+        }
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -26,6 +26,8 @@ struct Triangle
     using ScalarType       = Scalar;
     using IntersectionType = Intersection;
 
+    static constexpr bool left_handed_normal = LeftHandedNormal;
+
     Vector3<Scalar> p0, e1, e2, n;
 
     Triangle() = default;
@@ -0,0 +1,212 @@
+#ifndef BVH_TRIANGLE_BLOCK_HPP
+#define BVH_TRIANGLE_BLOCK_HPP
+
+#include <optional>
+#include <memory>
+#include <vector>
+#include <cassert>
+
+#include "bvh/triangle.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/simd.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// A block of `BlockSize` triangles stored in SoA form, with the same precomputed data as
+/// `bvh::Triangle`, so that all the triangles of a block can be intersected with a ray at
+/// once, with the SIMD instructions selected at compile time (see `bvh/simd.hpp`).
+/// Unused lanes contain degenerate triangles, which can never be intersected.
+template <typename Triangle, size_t BlockSize>
+struct TriangleBlock
+{
+    using Scalar       = typename Triangle::ScalarType;
+    using Intersection = typename Triangle::IntersectionType;
+    using Pack         = bvh::Pack<Scalar, BlockSize>;
+
+    static constexpr size_t size = BlockSize;
+
+    Scalar p0[3][BlockSize];
+    Scalar e1[3][BlockSize];
+    Scalar e2[3][BlockSize];
+    Scalar n [3][BlockSize];
+
+    void set(size_t lane, const Triangle& triangle) {
+        assert(lane < BlockSize);
+        for (int axis = 0; axis < 3; ++axis) {
+            p0[axis][lane] = triangle.p0[axis];
+            e1[axis][lane] = triangle.e1[axis];
+            e2[axis][lane] = triangle.e2[axis];
+            n [axis][lane] = triangle.n [axis];
+        }
+    }
+
+    void clear(size_t lane) {
+        // A null normal and null edges produce NaNs in the barycentric coordinates
+        for (int axis = 0; axis < 3; ++axis)
+            p0[axis][lane] = e1[axis][lane] = e2[axis][lane] = n[axis][lane] = 0;
+    }
+
+    /// Intersects the block with a ray, using the same algorithm as `Triangle::intersect()`.
+    /// Returns the lane of the closest intersection, or of any intersection if `any_hit` is set.
+    bvh_always_inline
+    std::optional<std::pair<size_t, Intersection>> intersect(const Ray<Scalar>& ray, bool any_hit) const
+    {
+        static constexpr Scalar sign = Triangle::left_handed_normal ? Scalar(1) : Scalar(-1);
+
+        auto dot = [] (const Pack* a, const Pack* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; };
+
+        Pack c[3], r[3], d[3], packed_n[3], packed_e1[3], packed_e2[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            c[axis] = Pack::load(p0[axis]) - Pack(ray.origin[axis]);
+            d[axis] = Pack(ray.direction[axis]);
+            packed_n [axis] = Pack::load(n [axis]);
+            packed_e1[axis] = Pack::load(e1[axis]);
+            packed_e2[axis] = Pack::load(e2[axis]);
+        }
+        for (int i = 0; i < 3; ++i) {
+            int j = (i + 1) % 3;
+            int k = (i + 2) % 3;
+            r[i] = d[j] * c[k] - d[k] * c[j];
+        }
+
+        auto inv_det = Pack(sign) / dot(packed_n, d);
+        auto u = dot(r, packed_e2) * inv_det;
+        auto v = dot(r, packed_e1) * inv_det;
+        auto w = Pack(Scalar(1)) - u - v;
+        auto t = Pack(sign) * dot(packed_n, c) * inv_det;
+
+        // These comparisons return false when one of t, u, or v is a NaN
+        auto zero = Pack(Scalar(0));
+        auto mask =
+            (u >= zero) & (v >= zero) & (w >= zero) &
+            (t >= Pack(ray.tmin)) & (t <= Pack(ray.tmax));
+        auto bits = mask.bits();
+        if (!bits)
+            return std::nullopt;
+
+        Scalar ts[BlockSize], us[BlockSize], vs[BlockSize];
+        t.store(ts);
+        u.store(us);
+        v.store(vs);
+
+        // Among equally close hits, keep the last one, like the sequential loop over leaves does
+        size_t best_lane = first_bit_set(bits);
+        if (!any_hit) {
+            for (bits &= bits - 1; bits; bits &= bits - 1) {
+                auto lane = first_bit_set(bits);
+                if (ts[lane] <= ts[best_lane])
+                    best_lane = lane;
+            }
+        }
+        return std::make_optional(std::make_pair(best_lane, Intersection { ts[best_lane], us[best_lane], vs[best_lane] }));
+    }
+};
+
+/// The triangles of all the leaves of a BVH, packed in blocks. Every leaf gets its own
+/// blocks, so a leaf of up to `BlockSize` triangles is intersected with one SIMD test.
+/// The last block of a leaf is padded with empty lanes.
+template <typename Triangle, size_t BlockSize>
+struct TriangleBlocks
+{
+    using Block = TriangleBlock<Triangle, BlockSize>;
+
+    std::unique_ptr<Block[]> blocks;
+    /// Index of the first block of every leaf, indexed by the first primitive of the leaf.
+    std::unique_ptr<size_t[]> first_block;
+
+    size_t block_count = 0;
+
+    /// Builds the blocks from the leaves of the given BVH. If `permuted` is set,
+    /// the triangles must have been permuted with `bvh::permute_primitives()`.
+    template <typename Bvh>
+    void build(const Bvh& bvh, const Triangle* triangles, bool permuted)
+    {
+        std::vector<size_t> leaves;
+        size_t primitive_count = 0;
+        for (size_t i = 0; i < bvh.node_count; ++i) {
+            const auto& node = bvh.nodes[i];
+            if (node.is_leaf()) {
+                leaves.push_back(i);
+                primitive_count = std::max(primitive_count, size_t(node.first_child_or_primitive + node.primitive_count));
+            }
+        }
+
+        first_block = std::make_unique<size_t[]>(primitive_count);
+        block_count = 0;
+        for (auto leaf : leaves) {
+            const auto& node = bvh.nodes[leaf];
+            first_block[node.first_child_or_primitive] = block_count;
+            block_count += (node.primitive_count + BlockSize - 1) / BlockSize;
+        }
+
+        blocks = std::make_unique<Block[]>(block_count);
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            const auto& node = bvh.nodes[leaves[i]];
+            size_t begin = node.first_child_or_primitive;
+            size_t end   = begin + node.primitive_count;
+            auto* block = &blocks[first_block[begin]];
+            for (size_t j = begin; j < end; j += BlockSize, ++block) {
+                for (size_t lane = 0; lane < BlockSize; ++lane) {
+                    if (j + lane < end)
+                        block->set(lane, triangles[permuted ? j + lane : bvh.primitive_indices[j + lane]]);
+                    else
+                        block->clear(lane);
+                }
+            }
+        }
+    }
+};
+
+/// Primitive intersector that intersects whole leaves at once, using triangle blocks.
+/// The results are the same as those of `ClosestPrimitiveIntersector` (or, if `AnyHit`
+/// is set, of an intersector that exits after the first hit).
+template <typename Bvh, typename Triangle, size_t BlockSize, bool Permuted = false, bool AnyHit = false>
+struct TriangleBlockIntersector
+{
+    using Scalar       = typename Triangle::ScalarType;
+    using Intersection = typename Triangle::IntersectionType;
+    using Blocks       = TriangleBlocks<Triangle, BlockSize>;
+
+    struct Result
+    {
+        size_t       primitive_index;
+        Intersection intersection;
+
+        Scalar distance() const { return intersection.distance(); }
+    };
+
+    static constexpr bool any_hit           = AnyHit;
+    static constexpr bool intersects_leaves = true;
+
+    TriangleBlockIntersector(const Bvh& bvh, const Blocks& blocks)
+        : bvh(bvh), blocks(blocks)
+    {}
+
+    /// Intersects the leaf that contains the primitives in the range [begin, end).
+    bvh_always_inline
+    std::optional<Result> intersect_leaf(size_t begin, size_t end, Ray<Scalar> ray) const
+    {
+        std::optional<Result> best_hit;
+        auto* block = &blocks.blocks[blocks.first_block[begin]];
+        for (size_t i = begin; i < end; i += BlockSize, ++block) {
+            if (auto hit = block->intersect(ray, AnyHit)) {
+                auto index = i + hit->first;
+                best_hit = std::make_optional(Result { Permuted ? index : bvh.primitive_indices[index], hit->second });
+                if (AnyHit)
+                    break;
+                ray.tmax = hit->second.distance();
+            }
+        }
+        return best_hit;
+    }
+
+    const Bvh& bvh;
+    const Blocks& blocks;
+};
+
+} // namespace bvh
+
+#endif
@@ -11,6 +11,10 @@
 #include <climits>
 #include <type_traits>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "bvh/bounding_box.hpp"
 
 namespace bvh {
@@ -70,6 +74,22 @@ void atomic_max(std::atomic<T>& x, T y) {
     while (z < y && !x.compare_exchange_weak(z, y)) ;
 }
 
+/// Atomically adds `y` to `x`, and returns the previous value of `x`. Unlike `#pragma omp atomic`,
+/// this remains atomic when OpenMP is disabled, or when called from threads that OpenMP does not
+/// know about (see `WorkStealingExecutor`).
+inline size_t atomic_fetch_add(size_t& x, size_t y) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_fetch_add(&x, y, __ATOMIC_RELAXED);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    return _InterlockedExchangeAdd64(reinterpret_cast<volatile long long*>(&x), y);
+#else
+    size_t z;
+    #pragma omp atomic capture
+    { z = x; x += y; }
+    return z;
+#endif
+}
+
 /// Templates that contains signed and unsigned integer types of the given number of bits.
 template <size_t Bits>
 struct SizedIntegerType {
@@ -0,0 +1,64 @@
+#ifndef BVH_WIDE_BVH_HPP
+#define BVH_WIDE_BVH_HPP
+
+#include <climits>
+#include <memory>
+#include <cassert>
+
+#include "bvh/bounding_box.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// A BVH where every node has up to `Arity` children. The bounding boxes of the children
+/// are stored in the parent node in SoA form, so that a ray can be intersected with all
+/// the children of a node with one SIMD slab test. Leaves do not have nodes of their own:
+/// they are stored as children of their parent node. The root is located at index 0.
+/// This is usually obtained by collapsing a binary BVH (see `bvh::WideBvhCollapser`).
+template <typename Scalar, size_t Arity>
+struct WideBvh
+{
+    using IndexType  = typename SizedIntegerType<sizeof(Scalar) * CHAR_BIT>::Unsigned;
+    using ScalarType = Scalar;
+
+    static constexpr size_t arity = Arity;
+
+    struct Node
+    {
+        /// Child bounds: `bounds[axis * 2 + 0][i]` (resp. `+ 1`) is the minimum
+        /// (resp. maximum) of the bounding box of child `i` on the given axis.
+        Scalar bounds[6][Arity];
+        /// Index of the child node, or index of the first primitive for leaves.
+        IndexType first_child_or_primitive[Arity];
+        /// Number of primitives in each child (zero for inner children).
+        IndexType primitive_count[Arity];
+        /// Number of valid children. Valid children are stored first.
+        IndexType child_count;
+
+        bool is_leaf(size_t i) const { return primitive_count[i] != 0; }
+
+        BoundingBox<Scalar> child_bounding_box(size_t i) const
+        {
+            return BoundingBox<Scalar>(
+                Vector3<Scalar>(bounds[0][i], bounds[2][i], bounds[4][i]),
+                Vector3<Scalar>(bounds[1][i], bounds[3][i], bounds[5][i]));
+        }
+
+        void set_child_bounding_box(size_t i, const BoundingBox<Scalar>& bbox)
+        {
+            for (int axis = 0; axis < 3; ++axis) {
+                bounds[axis * 2 + 0][i] = bbox.min[axis];
+                bounds[axis * 2 + 1][i] = bbox.max[axis];
+            }
+        }
+    };
+
+    std::unique_ptr<Node[]>   nodes;
+    std::unique_ptr<size_t[]> primitive_indices;
+
+    size_t node_count = 0;
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef BVH_WIDE_BVH_COLLAPSER_HPP
+#define BVH_WIDE_BVH_COLLAPSER_HPP
+
+#include <vector>
+#include <stack>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <cstdint>
+
+#include "bvh/bvh.hpp"
+#include "bvh/wide_bvh.hpp"
+#include "bvh/sah_based_algorithm.hpp"
+
+namespace bvh {
+
+/// Builds a wide BVH by collapsing the nodes of a binary BVH, regardless of the builder
+/// that was used to create it. Every wide node is created from a binary node, whose
+/// descendants are distributed among the `Arity` children of the wide node so as to
+/// minimize the SAH cost of the result. This cost is computed bottom-up with dynamic
+/// programming: for every binary node and every number of slots `k`, the collapser
+/// computes the cost of representing the subtree with at most `k` children of the parent
+/// wide node, either as a single child, or by opening the node and distributing its own
+/// children among the `k` slots (see "Efficient Incoherent Ray Traversal on GPUs Through
+/// Compressed Wide BVHs", by H. Ylitie et al.). Leaves of the binary BVH are kept as they are.
+template <typename Bvh, size_t Arity>
+class WideBvhCollapser : public SahBasedAlgorithm<Bvh>
+{
+    using Scalar   = typename Bvh::ScalarType;
+    using WideBvh  = bvh::WideBvh<Scalar, Arity>;
+    using WideNode = typename WideBvh::Node;
+
+    static_assert(Arity >= 2 && Arity < 256);
+
+    WideBvh& wide_bvh;
+
+    /// Cost of the best representation of a binary node with at most `k + 1` slots,
+    /// along with the number of slots given to its left child in that representation
+    /// (zero when the node is kept as a single child of the wide node). For inner nodes,
+    /// `wide_left_slots` is the number of slots given to the left child when the node
+    /// becomes a wide node of its own.
+    struct Choice {
+        Scalar  costs[Arity];
+        uint8_t left_slots[Arity];
+        uint8_t wide_left_slots;
+    };
+
+    /// Computes the best representation of every node of the binary BVH, children first.
+    std::unique_ptr<Choice[]> compute_choices(const Bvh& bvh) const {
+        auto choices = std::make_unique<Choice[]>(bvh.node_count);
+
+        // Parents are listed before their children, so that processing
+        // the list backwards visits the children of a node before the node.
+        std::vector<size_t> order;
+        order.reserve(bvh.node_count);
+        order.push_back(0);
+        for (size_t i = 0; i < order.size(); ++i) {
+            const auto& node = bvh.nodes[order[i]];
+            if (!node.is_leaf()) {
+                order.push_back(node.first_child_or_primitive + 0);
+                order.push_back(node.first_child_or_primitive + 1);
+            }
+        }
+
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            const auto& node = bvh.nodes[*it];
+            auto& choice = choices[*it];
+            auto area = node.bounding_box_proxy().half_area();
+            if (node.is_leaf()) {
+                std::fill(choice.costs, choice.costs + Arity, area * Scalar(node.primitive_count));
+                std::fill(choice.left_slots, choice.left_slots + Arity, 0);
+                choice.wide_left_slots = 0;
+                continue;
+            }
+
+            // Best way to distribute the children among `k + 1` slots
+            const auto& left  = choices[node.first_child_or_primitive + 0];
+            const auto& right = choices[node.first_child_or_primitive + 1];
+            Scalar  distributed_costs[Arity];
+            uint8_t distributed_left_slots[Arity];
+            distributed_costs[0] = std::numeric_limits<Scalar>::max();
+            distributed_left_slots[0] = 0;
+            for (size_t k = 1; k < Arity; ++k) {
+                distributed_costs[k] = std::numeric_limits<Scalar>::max();
+                for (size_t j = 0; j < k; ++j) {
+                    auto cost = left.costs[j] + right.costs[k - 1 - j];
+                    if (cost < distributed_costs[k]) {
+                        distributed_costs[k] = cost;
+                        distributed_left_slots[k] = j + 1;
+                    }
+                }
+            }
+
+            // A single slot means that the node becomes a wide node of its own, whose
+            // children are distributed among all the slots. With more slots, the node
+            // is only opened if this is cheaper than keeping it as one child.
+            choice.costs[0] = traversal_cost * area + distributed_costs[Arity - 1];
+            choice.left_slots[0] = 0;
+            choice.wide_left_slots = distributed_left_slots[Arity - 1];
+            for (size_t k = 1; k < Arity; ++k) {
+                if (distributed_costs[k] < choice.costs[k - 1]) {
+                    choice.costs[k] = distributed_costs[k];
+                    choice.left_slots[k] = distributed_left_slots[k];
+                } else {
+                    choice.costs[k] = choice.costs[k - 1];
+                    choice.left_slots[k] = choice.left_slots[k - 1];
+                }
+            }
+        }
+        return choices;
+    }
+
+    /// Adds the children that represent the given binary node with at most `slot_count` slots.
+    void gather_children(
+        const Bvh& bvh, const Choice* choices,
+        size_t index, size_t slot_count,
+        size_t* children, size_t& child_count) const
+    {
+        auto left_slots = choices[index].left_slots[slot_count - 1];
+        if (left_slots == 0) {
+            children[child_count++] = index;
+            return;
+        }
+        auto first_child = bvh.nodes[index].first_child_or_primitive;
+        gather_children(bvh, choices, first_child + 0, left_slots, children, child_count);
+        gather_children(bvh, choices, first_child + 1, slot_count - left_slots, children, child_count);
+    }
+
+public:
+    using SahBasedAlgorithm<Bvh>::traversal_cost;
+
+    WideBvhCollapser(WideBvh& wide_bvh)
+        : wide_bvh(wide_bvh)
+    {}
+
+    void collapse(const Bvh& bvh)
+    {
+        assert(bvh.node_count > 0);
+
+        auto choices = compute_choices(bvh);
+
+        std::vector<WideNode> nodes;
+        nodes.reserve(bvh.node_count / 2 + 1);
+        nodes.emplace_back();
+
+        size_t primitive_count = 0;
+
+        // Pairs of (binary node index, wide node index)
+        std::stack<std::pair<size_t, size_t>> stack;
+        stack.emplace(0, 0);
+        while (!stack.empty()) {
+            auto [binary_index, wide_index] = stack.top();
+            stack.pop();
+
+            // The children of the binary node are distributed among the slots of the wide node
+            size_t children[Arity];
+            size_t child_count = 0;
+            const auto& binary_node = bvh.nodes[binary_index];
+            if (binary_node.is_leaf())
+                children[child_count++] = binary_index;
+            else {
+                auto first_child = binary_node.first_child_or_primitive;
+                auto left_slots  = choices[binary_index].wide_left_slots;
+                gather_children(bvh, choices.get(), first_child + 0, left_slots, children, child_count);
+                gather_children(bvh, choices.get(), first_child + 1, Arity - left_slots, children, child_count);
+            }
+
+        WideNode wide_node;
+            wide_node.child_count = child_count;
+            for (size_t i = 0; i < Arity; ++i) {
+                if (i >= child_count) {
+                    // Unused slots get an empty bounding box
+                    wide_node.set_child_bounding_box(i, BoundingBox<Scalar>::empty());
+                    wide_node.first_child_or_primitive[i] = 0;
+                    wide_node.primitive_count[i] = 0;
+                    continue;
+                }
+                const auto& child = bvh.nodes[children[i]];
+                wide_node.set_child_bounding_box(i, child.bounding_box_proxy());
+                if (child.is_leaf()) {
+                    wide_node.first_child_or_primitive[i] = child.first_child_or_primitive;
+                    wide_node.primitive_count[i] = child.primitive_count;
+                    primitive_count = std::max(primitive_count, size_t(child.first_child_or_primitive + child.primitive_count));
+                } else {
+                    wide_node.first_child_or_primitive[i] = nodes.size();
+                    wide_node.primitive_count[i] = 0;
+                    stack.emplace(children[i], nodes.size());
+                    nodes.emplace_back();
+                }
+            }
+            nodes[wide_index] = wide_node;
+        }
+
+        wide_bvh.nodes = std::make_unique<WideNode[]>(nodes.size());
+        std::copy(nodes.begin(), nodes.end(), wide_bvh.nodes.get());
+        wide_bvh.node_count = nodes.size();
+
+        // Leaves refer to the same ranges of primitives as in the binary BVH
+        wide_bvh.primitive_indices = std::make_unique<size_t[]>(primitive_count);
+        std::copy(bvh.primitive_indices.get(), bvh.primitive_indices.get() + primitive_count, wide_bvh.primitive_indices.get());
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef BVH_WIDE_BVH_TRAVERSER_HPP
+#define BVH_WIDE_BVH_TRAVERSER_HPP
+
+#include <cassert>
+#include <cmath>
+#include <optional>
+
+#include "bvh/wide_bvh.hpp"
+#include "bvh/ray.hpp"
+#include "bvh/simd.hpp"
+#include "bvh/utilities.hpp"
+
+namespace bvh {
+
+/// Single ray traversal algorithm for wide BVHs. All the children of a node are intersected
+/// with one SIMD slab test, and the children that are hit are visited in front-to-back order.
+/// The ray-box test is the same as the one in `FastNodeIntersector`.
+template <typename WideBvh, size_t StackSize = 256>
+class WideBvhTraverser
+{
+public:
+    static constexpr size_t stack_size = StackSize;
+
+private:
+    using Scalar = typename WideBvh::ScalarType;
+    using Pack   = bvh::Pack<Scalar, WideBvh::arity>;
+
+    static constexpr size_t arity = WideBvh::arity;
+
+    struct Stack {
+        struct Element {
+            typename WideBvh::IndexType node_index;
+            Scalar distance;
+        };
+
+        Element elements[stack_size];
+        size_t size = 0;
+
+        void push(const Element& t) {
+            assert(size < stack_size);
+            elements[size++] = t;
+        }
+
+        Element pop() {
+            assert(!empty());
+            return elements[--size];
+        }
+
+        bool empty() const { return size == 0; }
+    };
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    bool intersect_leaf(
+        size_t begin, size_t end,
+        Ray<Scalar>& ray,
+        std::optional<typename PrimitiveIntersector::Result>& best_hit,
+        PrimitiveIntersector& primitive_intersector,
+        Statistics& statistics) const
+    {
+        statistics.intersections += end - begin;
+        if constexpr (PrimitiveIntersector::intersects_leaves) {
+            if (auto hit = primitive_intersector.intersect_leaf(begin, end, ray)) {
+                best_hit = hit;
+                if (primitive_intersector.any_hit)
+                    return true;
+                ray.tmax = hit->distance();
+            }
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                if (auto hit = primitive_intersector.intersect(i, ray)) {
+                    best_hit = hit;
+                    if (primitive_intersector.any_hit)
+                        return true;
+                    ray.tmax = hit->distance();
+                }
+            }
+        }
+        return false;
+    }
+
+    template <typename PrimitiveIntersector, typename Statistics>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    intersect(Ray<Scalar> ray, PrimitiveIntersector& primitive_intersector, Statistics& statistics) const
+    {
+        auto best_hit = std::optional<typename PrimitiveIntersector::Result>(std::nullopt);
+
+        // The octant of the ray determines which plane is the entry plane on each axis
+        int octant[3];
+        Pack inverse_direction[3], scaled_origin[3];
+        auto inverse = ray.direction.safe_inverse();
+        for (int axis = 0; axis < 3; ++axis) {
+            octant[axis] = std::signbit(ray.direction[axis]);
+            inverse_direction[axis] = Pack(inverse[axis]);
+            scaled_origin[axis]     = Pack(-ray.origin[axis] * inverse[axis]);
+        }
+
+        Stack stack;
+        stack.push(typename Stack::Element { 0, ray.tmin });
+        while (!stack.empty()) {
+            auto element = stack.pop();
+            if (element.distance > ray.tmax)
+                continue;
+
+            statistics.traversal_steps++;
+
+            const auto& node = bvh.nodes[element.node_index];
+            auto entry = Pack(ray.tmin);
+            auto exit  = Pack(ray.tmax);
+            for (int axis = 0; axis < 3; ++axis) {
+                auto near = Pack::load(node.bounds[axis * 2 +     octant[axis]]);
+                auto far  = Pack::load(node.bounds[axis * 2 + 1 - octant[axis]]);
+                entry = max(multiply_add(near, inverse_direction[axis], scaled_origin[axis]), entry);
+                exit  = min(multiply_add(far,  inverse_direction[axis], scaled_origin[axis]), exit);
+            }
+
+            auto hit_mask = (entry <= exit).bits() & ((uint32_t(1) << node.child_count) - 1);
+            if (!hit_mask)
+                continue;
+
+            // Sort the children that are hit by increasing entry distance
+            Scalar distances[arity];
+            size_t order[arity];
+            size_t hit_count = 0;
+            entry.store(distances);
+            for (; hit_mask; hit_mask &= hit_mask - 1) {
+                size_t child = first_bit_set(hit_mask), j = hit_count++;
+                for (; j > 0 && distances[order[j - 1]] > distances[child]; --j)
+                    order[j] = order[j - 1];
+                order[j] = child;
+            }
+
+            // Leaves are intersected immediately, front to back, while inner
+            // children are pushed back to front, so that the closest is popped first.
+            for (size_t i = 0; i < hit_count; ++i) {
+                auto child = order[i];
+                if (!node.is_leaf(child) || distances[child] > ray.tmax)
+                    continue;
+                size_t begin = node.first_child_or_primitive[child];
+                if (intersect_leaf(begin, begin + node.primitive_count[child], ray, best_hit, primitive_intersector, statistics))
+                    return best_hit;
+            }
+            for (size_t i = hit_count; i > 0; --i) {
+                auto child = order[i - 1];
+                if (node.is_leaf(child) || distances[child] > ray.tmax)
+                    continue;
+                stack.push(typename Stack::Element { node.first_child_or_primitive[child], distances[child] });
+            }
+        }
+
+        return best_hit;
+    }
+
+    const WideBvh& bvh;
+
+public:
+    /// Statistics collected during traversal.
+    struct Statistics {
+        size_t traversal_steps = 0;
+        size_t intersections   = 0;
+    };
+
+    WideBvhTraverser(const WideBvh& bvh)
+        : bvh(bvh)
+    {}
+
+    /// Intersects the BVH with the given ray and intersector.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& intersector) const
+    {
+        struct {
+            struct Empty {
+                Empty& operator ++ (int)    { return *this; }
+                Empty& operator ++ ()       { return *this; }
+                Empty& operator += (size_t) { return *this; }
+            } traversal_steps, intersections;
+        } statistics;
+        return intersect(ray, intersector, statistics);
+    }
+
+    /// Intersects the BVH with the given ray and intersector.
+    /// Record statistics on the number of traversal and intersection steps.
+    template <typename PrimitiveIntersector>
+    bvh_always_inline
+    std::optional<typename PrimitiveIntersector::Result>
+    traverse(const Ray<Scalar>& ray, PrimitiveIntersector& primitive_intersector, Statistics& statistics) const
+    {
+        return intersect(ray, primitive_intersector, statistics);
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef BVH_WORK_STEALING_DEQUE_HPP
+#define BVH_WORK_STEALING_DEQUE_HPP
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <cassert>
+#include <type_traits>
+
+namespace bvh {
+
+/// Lock-free work-stealing deque, based on "Dynamic Circular Work-Stealing Deque",
+/// by D. Chase and Y. Lev, with the memory orderings given in "Correct and Efficient
+/// Work-Stealing for Weak Memory Models", by N. M. Le et al.
+/// The owner thread pushes and pops items at the bottom of the deque, while other threads
+/// steal items from the top. Items are copied in and out of the deque, and should therefore
+/// be small descriptors of the work to do.
+template <typename T>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable_v<T>, "Items of a work-stealing deque must be trivially copyable");
+
+    struct Buffer {
+        int64_t capacity;
+        std::unique_ptr<T[]> items;
+
+        Buffer(int64_t capacity)
+            : capacity(capacity), items(std::make_unique<T[]>(capacity))
+        {}
+
+        T&       operator [] (int64_t i)       { return items[i & (capacity - 1)]; }
+        const T& operator [] (int64_t i) const { return items[i & (capacity - 1)]; }
+    };
+
+    alignas(64) std::atomic<int64_t> top;
+    alignas(64) std::atomic<int64_t> bottom;
+    std::atomic<Buffer*> buffer;
+
+    // Buffers are only freed with the deque, since thieves may still be reading from old ones.
+    std::vector<std::unique_ptr<Buffer>> buffers;
+
+    Buffer* grow(Buffer* old_buffer, int64_t top, int64_t bottom) {
+        auto new_buffer = std::make_unique<Buffer>(old_buffer->capacity * 2);
+        for (int64_t i = top; i < bottom; ++i)
+            (*new_buffer)[i] = (*old_buffer)[i];
+        buffers.push_back(std::move(new_buffer));
+        buffer.store(buffers.back().get(), std::memory_order_release);
+        return buffers.back().get();
+    }
+
+public:
+    /// Creates a deque with the given initial capacity, which must be a power of two.
+    WorkStealingDeque(size_t capacity = 64)
+        : top(0), bottom(0)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+        buffers.push_back(std::make_unique<Buffer>(capacity));
+        buffer.store(buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    /// Adds an item at the bottom of the deque. Must only be called by the owner thread.
+    void push(const T& item) {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto a = buffer.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+            a = grow(a, t, b);
+        (*a)[b] = item;
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    /// Removes the item at the bottom of the deque. Must only be called by the owner thread.
+    std::optional<T> pop() {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            // The deque is empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        T item = (*a)[b];
+        if (t == b) {
+            // Last item: race against thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won)
+                return std::nullopt;
+        }
+        return std::make_optional(item);
+    }
+
+    /// Removes the item at the top of the deque. Can be called by any thread.
+    /// This may fail spuriously when another thread takes the same item.
+    std::optional<T> steal() {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return std::nullopt;
+        auto a = buffer.load(std::memory_order_acquire);
+        T item = (*a)[t];
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return std::nullopt;
+        return std::make_optional(item);
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef BVH_WORK_STEALING_EXECUTOR_HPP
+#define BVH_WORK_STEALING_EXECUTOR_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+
+#include "bvh/work_stealing_deque.hpp"
+
+namespace bvh {
+
+/// Executor for recursive, fork-only workloads (such as top-down BVH construction), built on
+/// `std::thread` and one `WorkStealingDeque` per worker. Workers push the work they spawn on
+/// their own deque, and steal from the deques of other workers when theirs is empty.
+/// Unlike OpenMP tasks, this does not require the program to be compiled with OpenMP,
+/// and the only data that moves between threads are the work items themselves.
+class WorkStealingExecutor {
+    size_t thread_count;
+    bool running = false;
+
+public:
+    /// Creates an executor with the given number of workers, including the calling thread.
+    /// A count of zero uses one worker per hardware thread.
+    WorkStealingExecutor(size_t thread_count = 0)
+        : thread_count(thread_count > 0 ? thread_count : std::max(std::thread::hardware_concurrency(), 1u))
+    {}
+
+    size_t get_thread_count() const { return thread_count; }
+
+    /// Returns true when called from a worker, during `run()`.
+    bool is_running() const { return running; }
+
+    /// Calls `f(i)` for every `i` in [0, `count`[, using all the workers, and blocks until done.
+    /// When called from a worker during `run()`, the iterations are run serially by that worker.
+    template <typename F>
+    void parallel_for(size_t count, F&& f) {
+        if (running || thread_count == 1 || count <= 1) {
+            for (size_t i = 0; i < count; ++i)
+                f(i);
+            return;
+        }
+
+        std::atomic<size_t> next_index(0);
+        auto worker = [&] {
+            for (size_t i; (i = next_index.fetch_add(1, std::memory_order_relaxed)) < count;)
+                f(i);
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < std::min(thread_count, count); ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    /// Calls `process(worker_index, item, spawn)` on the given item, and on every item passed
+    /// to `spawn` during processing, until no work is left. The worker index is in the range
+    /// [0, `get_thread_count()`[, and can be used to access per-worker data without synchronization.
+    /// This function blocks until all the work is done, and uses the calling thread as the first worker.
+    template <typename Item, typename Process>
+    void run(const Item& first_item, Process&& process) {
+        run(std::vector<Item>(1, first_item), std::forward<Process>(process));
+    }
+
+    /// Same as `run()`, starting with several items, which are spread over the workers.
+    template <typename Item, typename Process>
+    void run(const std::vector<Item>& first_items, Process&& process) {
+        std::vector<std::unique_ptr<WorkStealingDeque<Item>>> deques(thread_count);
+        for (auto& deque : deques)
+            deque = std::make_unique<WorkStealingDeque<Item>>();
+
+        // Number of items that have been spawned but not processed yet
+        std::atomic<size_t> pending_count(first_items.size());
+        for (size_t i = 0; i < first_items.size(); ++i)
+            deques[i % thread_count]->push(first_items[i]);
+
+        auto worker = [&] (size_t worker_index) {
+            auto& deque = *deques[worker_index];
+            auto spawn = [&] (const Item& item) {
+                pending_count.fetch_add(1, std::memory_order_relaxed);
+                deque.push(item);
+            };
+
+            size_t victim = worker_index;
+            while (pending_count.load(std::memory_order_acquire) > 0) {
+                auto item = deque.pop();
+                // Try the other workers in turn, starting after the last successful victim
+                for (size_t i = 1; !item && i < thread_count; ++i) {
+                    victim = (victim + 1) % thread_count;
+                    if (victim == worker_index)
+                        victim = (victim + 1) % thread_count;
+                    item = deques[victim]->steal();
+                }
+                if (item) {
+                    process(worker_index, *item, spawn);
+                    pending_count.fetch_sub(1, std::memory_order_acq_rel);
+                } else
+                    std::this_thread::yield();
+            }
+        };
+
+        running = true;
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < thread_count; ++i)
+            threads.emplace_back(worker, i);
+        worker(0);
+        for (auto& thread : threads)
+            thread.join();
+        running = false;
+    }
+};
+
+} // namespace bvh
+
+#endif
@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <bvh/vector.hpp>
+#include <bvh/triangle.hpp>
+
+using Scalar   = float;
+using Vector3  = bvh::Vector3<Scalar>;
+using Triangle = bvh::Triangle<Scalar>;
+
+#include "obj.hpp"
+#include "binary_mesh.hpp"
+
+// Converts an OBJ scene into the binary mesh format of `binary_mesh.hpp`,
+// which the benchmark maps into memory instead of parsing it.
+static void usage()
+{
+    std::cout <<
+        "Usage: obj2bin [options] input.obj output.bin\n"
+        "\nOptions:\n"
+        "  --help                  Shows this message.\n"
+        "  --no-triangles          Only stores the vertices and indices, and not the precomputed\n"
+        "                          triangles (about 4 times smaller, but the triangles must then\n"
+        "                          be built when loading the file).\n"
+        << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    const char* input_file  = NULL;
+    const char* output_file = NULL;
+    bool with_triangles = true;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            if (!strcmp(argv[i], "--help")) {
+                usage();
+                return 1;
+            } else if (!strcmp(argv[i], "--no-triangles")) {
+                with_triangles = false;
+            } else {
+                std::cerr << "Unknown option: '" << argv[i] << "'" << std::endl;
+                return 1;
+            }
+        } else if (!input_file) {
+            input_file = argv[i];
+        } else if (!output_file) {
+            output_file = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (!input_file || !output_file)
+    {
+        usage();
+        return 1;
+    }
+
+    using namespace std::chrono;
+    auto start_tick = high_resolution_clock::now();
+    obj::Mesh mesh;
+    if (!obj::load_mesh_from_file(input_file, mesh) || mesh.indices.empty())
+    {
+        std::cerr << "The given scene is empty or cannot be loaded" << std::endl;
+        return 1;
+    }
+    auto load_tick = high_resolution_clock::now();
+
+    size_t triangle_count = mesh.indices.size() / 3;
+    if (!binary_mesh::save(
+        output_file,
+        mesh.vertices.data(), mesh.vertices.size(),
+        mesh.indices.data(), triangle_count,
+        with_triangles))
+    {
+        std::cerr << "Could not write '" << output_file << "'" << std::endl;
+        return 1;
+    }
+    auto save_tick = high_resolution_clock::now();
+
+    std::cout
+        << "Converted " << mesh.vertices.size() << " vertices and " << triangle_count << " triangles "
+        << "(loading took " << duration<double, std::milli>(load_tick - start_tick).count() << " ms, "
+        << "writing took " << duration<double, std::milli>(save_tick - load_tick).count() << " ms)" << std::endl;
+    return 0;
+}
@@ -287,6 +287,9 @@ void GUIModeMain(RenderSetting &setting)
                     ImGui::RadioButton("spatial_split", &setting.bvhBuilderType, Spatial_Split);
                     ImGui::RadioButton("locally_ordered_clustering", &setting.bvhBuilderType, Locally_Ordered_Clustering);
                     ImGui::RadioButton("linear", &setting.bvhBuilderType, Linear);
+                    ImGui::RadioButton("hlbvh", &setting.bvhBuilderType, HLBVH);
+                    ImGui::RadioButton("aac", &setting.bvhBuilderType, AAC);
+                    ImGui::RadioButton("radix_tree", &setting.bvhBuilderType, Radix_Tree);
                 }
                 ImGui::Separator();
                 bool newTaskCheckable = !(activeTaskHandle == Invalid_Task_Handle); 
@@ -72,6 +72,9 @@ static std::map<BVHBuilderType, std::string> g_BVHBuilderNames =
     {Spatial_Split, "spatial_split"},
     {Locally_Ordered_Clustering, "locally_ordered_clustering"},
     {Linear, "linear"},
+    {HLBVH, "hlbvh"},
+    {AAC, "aac"},
+    {Radix_Tree, "radix_tree"},
 };
 
 std::string BvhBuilderTypeStr(BVHBuilderType type)
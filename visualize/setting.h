@@ -18,6 +18,9 @@ enum BVHBuilderType
     Spatial_Split = 2,              //spatial_split
     Locally_Ordered_Clustering = 3, //locally_ordered_clustering
     Linear = 4,                     //linear
+    HLBVH = 5,                      //hlbvh
+    AAC = 6,                        //aac
+    Radix_Tree = 7,                 //radix_tree
     Builder_Count
 };
 